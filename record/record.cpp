@@ -11,14 +11,13 @@
 *******************************************************************/
 
 #include <iostream>
-#include <queue>
-#include <condition_variable>
+#include <thread>
 #include "../src/gutil.h"
 #include "../src/gdemux.h"
 #include "../src/gdec.h"
-#include "../src/gsws.h"
 #include "../src/genc.h"
 #include "../src/gmux.h"
+#include "../src/gpipeline.h"
 
 const int FPS = 30;
 const char* STRFPS = "30";
@@ -30,7 +29,6 @@ const long long BITRATE = 2000000;
 int main(int argc, char* argv[])
 {
     int ret = 0;
-    bool bstop = false;
     // 流索引
     std::vector<unsigned int> videovec, audiovec;
     int vindex = -1;
@@ -39,19 +37,11 @@ int main(int argc, char* argv[])
     const AVCodecParameters* vpar = nullptr;
     const AVCodecContext* vcodectx = nullptr;
     AVRational vtimebase;
-    AVRational ovtimebase;
-    // 帧队列
-    std::queue<std::shared_ptr<AVPacket>> packet_queue;
-    std::mutex packet_queue_mutex;
-    std::condition_variable packet_queue_cv;
-    std::queue<std::shared_ptr<AVFrame>> vframe_queue;
-    std::mutex vframe_queue_mutex;
-    std::condition_variable vframe_queue_cv;
-    std::queue<std::shared_ptr<AVPacket>> opacket_queue;
-    std::mutex opacket_queue_mutex;
-    std::condition_variable opacket_queue_cv;
+
     // 视频解封装
     gff::gdemux demux_desktop;
+    ret = demux_desktop.set_open_profile(gff::OPEN_LIVE);
+    CHECKFFRET(ret);
     ret = demux_desktop.open("desktop", "gdigrab", { {"framerate", STRFPS} });
     CHECKFFRET(ret);
     ret = demux_desktop.get_steam_index(videovec, audiovec);
@@ -59,160 +49,11 @@ int main(int argc, char* argv[])
     vindex = videovec.size() > 0 ? videovec.at(0) : -1;
     ret = demux_desktop.get_stream_par(vindex, vpar, vtimebase);
     CHECKFFRET(ret);
-    // 视频解封装线程
-    std::thread demux_desktop_thread([&]()
-    {
-        int64_t startpts = -1;
-        decltype(gff::GetPacket()) packet = nullptr;
-        do
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            // 分配packet
-            packet = gff::GetPacket();
-            if (packet == nullptr)
-            {
-                CHECKFFRET(AVERROR(ENOMEM));
-            }
-            // 读packet
-            ret = demux_desktop.readpacket(packet);
-            if (ret != 0)
-            {
-                av_log(nullptr, AV_LOG_ERROR, "%s %d : %ld\n", __FILE__, __LINE__, ret);
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-                continue;
-            }
-            // pts
-            if (startpts == -1)
-            {
-                startpts = packet->pts;
-            }
-            packet->pts -= startpts;
-
-            /*std::cout << "got a packet, index " << packet->stream_index << " pts " <<
-                av_rescale_q(packet->pts, vtimebase, { 1,1 }) << std::endl;*/
-
-            {
-                // 推packet队列
-                std::lock_guard<decltype(packet_queue_mutex)> _lock(packet_queue_mutex);
-                if (packet_queue.size() > MAXNUM)
-                {
-                    std::queue<std::shared_ptr<AVPacket>> empty;
-                    packet_queue.swap(empty);
-                    std::cout << "too many packets" << std::endl;
-                }
-                packet_queue.push(packet);
-                packet_queue_cv.notify_all();
-            }
-
-        } while (!bstop);
-
-        std::cout << "exit demux_desktop_thread" << std::endl;
-        return 0;
-    }
-    );
 
     // 视频解码
     gff::gdec vdec;
     ret = vdec.copy_param(vpar);
     CHECKFFRET(ret);
-    // 视频解码线程
-    std::thread vdec_thread([&]()
-    {
-        int ret = 0;
-        decltype(gff::GetPacket()) packet = nullptr;
-        decltype(gff::GetFrame()) frame = nullptr;
-        gff::gsws sws;
-        bool bcreated = false;
-        do
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            if (frame != nullptr)
-            {
-                decltype(gff::GetFrame()) pushframe = nullptr;
-                if (frame->format != AV_PIX_FMT_NV12)
-                {
-                    // 帧格式转换
-                    if (!bcreated)
-                    {
-                        ret = sws.create_sws(static_cast<AVPixelFormat>(frame->format), frame->width, frame->height,
-                            AV_PIX_FMT_NV12, frame->width, frame->height);
-                        CHECKFFRET(ret);
-                        bcreated = true;
-                    }
-                    auto nvframe = gff::GetFrame();
-                    if (nvframe == nullptr)
-                    {
-                        CHECKFFRET(AVERROR(ENOMEM));
-                    }
-                    ret = gff::GetFrameBuf(nvframe, frame->width, frame->height, AV_PIX_FMT_NV12, 1);
-                    CHECKFFRET(ret);
-                    ret = sws.scale(frame->data, frame->linesize, 0, frame->height, nvframe->data, nvframe->linesize);
-                    CHECKFFRET(ret);
-
-                    pushframe = nvframe;
-                }
-                else
-                {
-                    pushframe = frame;
-                }
-
-                // pts
-                pushframe->pts = frame->pts;
-
-                {
-                    // 推vframe队列
-                    std::lock_guard<decltype(vframe_queue_mutex)> _lock(vframe_queue_mutex);
-                    if (vframe_queue.size() > MAXNUM)
-                    {
-                        std::queue<std::shared_ptr<AVFrame>> empty;
-                        vframe_queue.swap(empty);
-                        std::cout << "too many vframes" << std::endl;
-                    }
-                    vframe_queue.push(pushframe);
-                    vframe_queue_cv.notify_all();
-                }
-
-                /*std::cout << "got a vframe, pts " <<
-                    av_rescale_q(frame->pts, vtimebase, { 1,1 }) << std::endl;*/
-            }
-
-            frame = gff::GetFrame();
-            if (frame == nullptr)
-            {
-                CHECKFFRET(AVERROR(ENOMEM));
-            }
-
-            {
-                std::unique_lock<std::mutex> lck(packet_queue_mutex);
-                if (packet_queue.size() > 0)
-                {
-                    packet = packet_queue.front();
-                    packet_queue.pop();
-                }
-                else if (packet_queue_cv.wait_for(lck, std::chrono::seconds(1)) != std::cv_status::timeout)
-                {
-                    if (packet_queue.size() > 0)
-                    {
-                        packet = packet_queue.front();
-                        packet_queue.pop();
-                    }
-                }
-            }
-
-            // 解码
-            ret = vdec.decode(packet, frame);
-            if (ret == AVERROR(EAGAIN))
-            {
-                frame = nullptr;
-                ret = 0;
-            }
-
-        } while (ret == 0 && !bstop);
-
-        std::cout << "exit vdec_thread" << std::endl;
-        return 0;
-    }
-    );
 
     // 视频编码
     gff::genc venc;
@@ -220,72 +61,6 @@ int main(int argc, char* argv[])
     CHECKFFRET(ret);
     ret = venc.get_codectx(vcodectx);
     CHECKFFRET(ret);
-    // 视频编码线程
-    std::thread venc_thread([&]()
-    {
-        int ret = 0;
-        decltype(gff::GetPacket()) packet = nullptr;
-        decltype(gff::GetFrame()) frame = nullptr;
-        do
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            frame = nullptr;
-            {
-                std::unique_lock<std::mutex> lck(vframe_queue_mutex);
-                if (vframe_queue.size() > 0)
-                {
-                    frame = vframe_queue.front();
-                    vframe_queue.pop();
-                }
-                else if (packet_queue_cv.wait_for(lck, std::chrono::seconds(1)) != std::cv_status::timeout)
-                {
-                    if (vframe_queue.size() > 0)
-                    {
-                        frame = vframe_queue.front();
-                        vframe_queue.pop();
-                    }
-                }
-            }
-
-            if (frame != nullptr)
-            {
-                /*std::cout << "got a vframe, pts " <<
-                    av_rescale_q(frame->pts, vtimebase, { 1,1 }) << std::endl;*/
-                    // 编码
-                ret = venc.encode_push_frame(frame);
-                CHECKFFRET(ret);
-                do
-                {
-                    packet = gff::GetPacket();
-                    ret = venc.encode_get_packet(packet);
-                    packet->pts = frame->pts;
-                    /*std::cout << "got a vpacket, pts " <<
-                        av_rescale_q(packet->pts, vtimebase, { 1,1 }) << std::endl;*/
-                    {
-                        // 推opacket队列
-                        std::lock_guard<decltype(opacket_queue_mutex)> _lock(opacket_queue_mutex);
-                        if (opacket_queue.size() > MAXNUM)
-                        {
-                            std::queue<std::shared_ptr<AVPacket>> empty;
-                            opacket_queue.swap(empty);
-                            std::cout << "too many opackets" << std::endl;
-                        }
-                        opacket_queue.push(packet);
-                        opacket_queue_cv.notify_all();
-                    }
-                } while (ret == 0);
-                if (ret == AVERROR(EAGAIN))
-                {
-                    ret = 0;
-                }
-            }
-
-        } while (ret == 0 && !bstop);
-
-        std::cout << "exit venc_thread" << std::endl;
-        return 0;
-    }
-    );
 
     // 视频封装
     gff::gmux mux;
@@ -293,61 +68,17 @@ int main(int argc, char* argv[])
     CHECKFFRET(ret);
     ret = mux.create_stream(vcodectx, ovindex);
     CHECKFFRET(ret);
-    ret = mux.write_header();
-    CHECKFFRET(ret);
-    ret = mux.get_timebase(ovindex, ovtimebase);
+    // 每个包写入后立即刷新到文件
+    ret = mux.write_header({ {"flush_packets", "1"} });
     CHECKFFRET(ret);
-    // 视频封装线程
-    std::thread mux_thread([&]()
-    {
-        int ret = 0;
-        decltype(gff::GetPacket()) packet = nullptr;
-        decltype(gff::GetFrame()) frame = nullptr;
-        int64_t lastpts = -1;
-        do
-        {
-            packet = nullptr;
-            {
-                std::unique_lock<std::mutex> lck(opacket_queue_mutex);
-                if (opacket_queue.size() > 0)
-                {
-                    packet = opacket_queue.front();
-                    opacket_queue.pop();
-                }
-                else if (packet_queue_cv.wait_for(lck, std::chrono::seconds(1)) != std::cv_status::timeout)
-                {
-                    if (opacket_queue.size() > 0)
-                    {
-                        packet = opacket_queue.front();
-                        opacket_queue.pop();
-                    }
-                }
-            }
-
-            if (packet != nullptr)
-            {
-                // 封装
-                packet->pts = av_rescale_q(packet->pts, vtimebase, ovtimebase);
-                if (packet->pts <= lastpts)
-                {
-                    packet->pts = lastpts + 1;
-
-                }
-                packet->duration = 1;
-                packet->dts = packet->pts;
-                lastpts = packet->pts;
 
-                /*std::cout << "write a vpacket, pts " <<
-                    av_rescale_q(packet->pts, ovtimebase, { 1,1 }) << std::endl;*/
-                ret = mux.write_packet(packet);
-                CHECKFFRET(ret);
-            }
-        } while (ret == 0 && !bstop);
-
-        std::cout << "exit mux_thread" << std::endl;
-        return 0;
-    }
-    );
+    // 每个阶段在自己的输入队列上阻塞, 数据到达即被唤醒
+    // 帧格式转换(转NV12)由流水线按编码参数创建
+    gff::gpipeline pipeline;
+    ret = pipeline.set_stages(&demux_desktop, vindex, &vdec, nullptr, &venc, &mux, ovindex, MAXNUM);
+    CHECKFFRET(ret);
+    ret = pipeline.start();
+    CHECKFFRET(ret);
 
     char buf[10] = { 0 };
     while (std::cin.getline(buf, sizeof(buf)) && buf[0] != 'q')
@@ -355,24 +86,34 @@ int main(int argc, char* argv[])
         std::this_thread::sleep_for(std::chrono::microseconds(100));
     }
 
-    bstop = true;
-    if (demux_desktop_thread.joinable())
-    {
-        demux_desktop_thread.join();
-    }
-    if (vdec_thread.joinable())
-    {
-        vdec_thread.join();
-    }
-    if (venc_thread.joinable())
+    // 排空解码器和编码器后结束
+    ret = pipeline.stop();
+    CHECKFFRET(ret);
+
+    const char* names[gff::STAGE_NB] = { "demux", "decode", "scale", "encode", "mux" };
+    for (int i = 0; i < gff::STAGE_NB; ++i)
     {
-        venc_thread.join();
+        gff::gstagestats stats = { 0 };
+        pipeline.get_stage_stats(static_cast<gff::PIPELINESTAGE>(i), stats);
+        std::cout << names[i] << " : in " << stats.inputs << " out " << stats.outputs <<
+            " fps " << stats.fps << " load " << stats.load << std::endl;
     }
-    if (mux_thread.joinable())
+
+    // 采集到封装的延时
+    gff::glatencystats latency = { 0 };
+    pipeline.get_latency_stats(latency);
+    std::cout << "latency(us) count " << latency.count << " min " << latency.minus << " mean " << latency.meanus <<
+        " p50 " << latency.p50us << " p90 " << latency.p90us << " p99 " << latency.p99us << " max " << latency.maxus << std::endl;
+    std::vector<std::pair<int64_t, uint64_t>> buckets;
+    pipeline.get_latency_buckets(buckets);
+    for (const auto& bucket : buckets)
     {
-        mux_thread.join();
+        std::cout << "  <= " << bucket.first << " : " << bucket.second << std::endl;
     }
 
+    pipeline.cleanup();
+    mux.cleanup();
+
     std::cin.get();
 
     return 0;
@@ -13,12 +13,66 @@
 #ifndef __GAVBASE_H__
 #define __GAVBASE_H__
 
+#include <atomic>
+#include <cassert>
 #include <memory>
 #include <mutex>
+#include <thread>
+
+// 锁策略, 编译时通过GFF_LOCK_POLICY选择
+#define GFF_LOCK_RECURSIVE  0   // 递归锁
+#define GFF_LOCK_MUTEX      1   // 普通互斥锁
+#define GFF_LOCK_NONE       2   // 不加锁, 对象只能由一个线程同时使用
+#ifndef GFF_LOCK_POLICY
+#define GFF_LOCK_POLICY GFF_LOCK_RECURSIVE
+#endif
 
 namespace gff
 {
+    // 不加锁, 调试版本断言没有两个线程同时进入
+    class gnolock
+    {
+    public:
+        void lock()
+        {
+#ifndef NDEBUG
+            auto self = std::this_thread::get_id();
+            auto owner = std::thread::id();
+            if (!owner_.compare_exchange_strong(owner, self))
+            {
+                assert(owner == self && "gff object used by multiple threads without lock");
+            }
+            ++depth_;
+#endif
+        }
+
+        void unlock()
+        {
+#ifndef NDEBUG
+            if (--depth_ == 0)
+            {
+                owner_.store(std::thread::id());
+            }
+#endif
+        }
+
+    private:
+#ifndef NDEBUG
+        std::atomic<std::thread::id> owner_{ std::thread::id() };
+        int depth_ = 0;
+#endif
+    };
+
+#if GFF_LOCK_POLICY == GFF_LOCK_RECURSIVE
     typedef std::recursive_mutex gmutex;
+#elif GFF_LOCK_POLICY == GFF_LOCK_MUTEX
+    typedef std::mutex gmutex;
+#elif GFF_LOCK_POLICY == GFF_LOCK_NONE
+    typedef gnolock gmutex;
+#else
+#error "unknown GFF_LOCK_POLICY"
+#endif
+
     typedef enum STATUS { STOP, WORKING } STATUS;
     class gavbase
     {
@@ -13,8 +13,69 @@
 #include "gdec.h"
 #include "gutil.h"
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <libavutil/pixdesc.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <climits>
+
 namespace gff
 {
+	// 帧数据地址和行对齐, 满足ffmpeg各平台SIMD的要求
+	static const int DEC_BUFFER_ALIGN = 64;
+
+	gpoolallocator::~gpoolallocator()
+	{
+		// 已分配的缓冲区在最后一个引用释放后由AVBufferPool自行回收
+		for (auto& p : pools_)
+		{
+			av_buffer_pool_uninit(&p.second);
+		}
+	}
+
+	AVBufferRef* gpoolallocator::alloc(int size)
+	{
+		std::lock_guard<std::mutex> _lock(mutex_);
+
+		auto it = pools_.find(size);
+		if (it == pools_.end())
+		{
+			auto pool = av_buffer_pool_init2(size, this, pool_alloc, nullptr);
+			if (pool == nullptr)
+			{
+				return nullptr;
+			}
+			it = pools_.emplace(size, pool).first;
+		}
+		++gets_;
+
+		return av_buffer_pool_get(it->second);
+	}
+
+	void gpoolallocator::get_stats(uint64_t& hits, uint64_t& misses)
+	{
+		misses = misses_;
+		hits = gets_ - misses;
+	}
+
+	AVBufferRef* gpoolallocator::pool_alloc(void* opaque, int size)
+	{
+		// av_buffer_alloc按av_malloc的对齐分配
+		auto buf = av_buffer_alloc(size);
+		if (buf != nullptr)
+		{
+			++static_cast<gpoolallocator*>(opaque)->misses_;
+		}
+		return buf;
+	}
+
 	gdec::~gdec()
 	{
 		cleanup();
@@ -24,21 +85,30 @@ namespace gff
 	{
 		LOCK();
 
+		return release();
+	}
+
+	int gdec::release()
+	{
 		av_parser_close(par_);
 		par_ = nullptr;
 		avcodec_free_context(&codectx_);
+		skipframe_ = AVDISCARD_DEFAULT;
+		preview_ = DECPREVIEW_NONE;
+		previewfast_ = false;
 		getstatus() = STOP;
 
 		return 0;
 	}
 
-	int gdec::copy_param(const AVCodecParameters* par, AVHWDeviceType hwtype /*= AV_HWDEVICE_TYPE_NONE*/)
+	int gdec::copy_param(const AVCodecParameters* par, AVHWDeviceType hwtype /*= AV_HWDEVICE_TYPE_NONE*/,
+		const std::vector<std::pair<std::string, std::string>>& dicts/* = {}*/)
 	{
 		LOCK();
 		CHECKSTOP();
 		int ret = 0;
 
-		cleanup();
+		release();
 
 		auto codec = avcodec_find_decoder(par->codec_id);
 		if (codec == nullptr)
@@ -91,7 +161,50 @@ namespace gff
 			}
 		}
 
-		ret = avcodec_open2(codectx_, codec, nullptr);
+		// 线程
+		codectx_->thread_count = threadcount_;
+		switch (threadtype_)
+		{
+		case DECTHREAD_FRAME:
+			codectx_->thread_type = FF_THREAD_FRAME;
+			break;
+		case DECTHREAD_SLICE:
+			codectx_->thread_type = FF_THREAD_SLICE;
+			break;
+		default:
+			codectx_->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+			break;
+		}
+
+		// 低分辨率, 只能在打开前设置
+		codectx_->lowres = FFMIN(lowres_, static_cast<int>(codec->max_lowres));
+
+		// 只接管软解视频帧, 解码器需要支持直接写入外部缓冲区
+		if (allocator_ != nullptr && hwtype == AV_HWDEVICE_TYPE_NONE &&
+			codec->type == AVMEDIA_TYPE_VIDEO && (codec->capabilities & AV_CODEC_CAP_DR1))
+		{
+			codectx_->opaque = allocator_.get();
+			codectx_->get_buffer2 = get_buffer;
+			// 分配器是线程安全的, 帧级多线程时不需要回到主线程分配
+			codectx_->thread_safe_callbacks = 1;
+		}
+
+		AVDictionary* dict = nullptr;
+		for (const auto& p : dicts)
+		{
+			if (p.first.size() > 0 && p.second.size() > 0)
+			{
+				ret = av_dict_set(&dict, p.first.c_str(), p.second.c_str(), 0);
+				if (ret < 0)
+				{
+					av_dict_free(&dict);
+					CHECKFFRET(ret);
+				}
+			}
+		}
+		ret = avcodec_open2(codectx_, codec, &dict);
+		// 解码器不认识的选项留在dict中
+		av_dict_free(&dict);
 		CHECKFFRET(ret);
 
 		getstatus() = WORKING;
@@ -99,17 +212,121 @@ namespace gff
 		return 0;
 	}
 
-	int gdec::decode(std::shared_ptr<AVPacket> packet, std::shared_ptr<AVFrame> frame)
+	int gdec::set_threads(DECTHREAD type, int count/* = 0*/)
+	{
+		LOCK();
+		CHECKSTOP();
+
+		if (count < 0)
+		{
+			CHECKFFRET(AVERROR(EINVAL));
+		}
+		threadtype_ = type;
+		threadcount_ = count;
+
+		return 0;
+	}
+
+	int gdec::set_allocator(const std::shared_ptr<gframeallocator>& allocator)
+	{
+		LOCK();
+		CHECKSTOP();
+
+		allocator_ = allocator;
+
+		return 0;
+	}
+
+	int gdec::get_buffer(AVCodecContext* ctx, AVFrame* frame, int flags)
+	{
+		auto allocator = static_cast<gframeallocator*>(ctx->opaque);
+		auto fmt = static_cast<AVPixelFormat>(frame->format);
+		auto desc = av_pix_fmt_desc_get(fmt);
+		if (allocator == nullptr || desc == nullptr || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) || ctx->hw_frames_ctx != nullptr)
+		{
+			return avcodec_default_get_buffer2(ctx, frame, flags);
+		}
+
+		// 解码器要求的宽高对齐(宏块, 运动补偿越界读取)
+		int w = frame->width;
+		int h = frame->height;
+		int linealign[AV_NUM_DATA_POINTERS] = { 0 };
+		avcodec_align_dimensions2(ctx, &w, &h, linealign);
+
+		// 增加宽度直到每个平面的行长度都满足对齐, 与avcodec_default_get_buffer2相同
+		int linesize[4] = { 0 };
+		bool unaligned = false;
+		do
+		{
+			int ret = av_image_fill_linesizes(linesize, fmt, w);
+			CHECKFFRET(ret);
+			w += w & ~(w - 1);
+			unaligned = false;
+			for (int i = 0; i < 4; ++i)
+			{
+				auto align = FFMAX(linealign[i], DEC_BUFFER_ALIGN);
+				unaligned = unaligned || (linesize[i] % align) != 0;
+			}
+		} while (unaligned);
+
+		// 所有平面放在一个缓冲区, 每个平面起始地址对齐
+		size_t planes[4] = { 0 };
+		size_t total = 0;
+		for (int i = 0; i < 4 && linesize[i] > 0; ++i)
+		{
+			auto lines = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(h, desc->log2_chroma_h) : h;
+			// 尾部留出SIMD越界读取的填充
+			planes[i] = FFALIGN(static_cast<size_t>(linesize[i]) * lines + 16, DEC_BUFFER_ALIGN);
+			total += planes[i];
+		}
+		if ((desc->flags & AV_PIX_FMT_FLAG_PAL) || (desc->flags & AV_PIX_FMT_FLAG_PSEUDOPAL))
+		{
+			// 调色板在data[1], 由解码器填写
+			planes[1] = FFALIGN(256 * 4, DEC_BUFFER_ALIGN);
+			total += planes[1];
+		}
+		if (total == 0 || total > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+		{
+			CHECKFFRET(AVERROR(EINVAL));
+		}
+
+		auto buf = allocator->alloc(static_cast<int>(total) + AV_INPUT_BUFFER_PADDING_SIZE);
+		if (buf == nullptr || (reinterpret_cast<uintptr_t>(buf->data) % DEC_BUFFER_ALIGN) != 0)
+		{
+			// 分配失败或不满足对齐时退回默认分配
+			av_buffer_unref(&buf);
+			return avcodec_default_get_buffer2(ctx, frame, flags);
+		}
+
+		frame->buf[0] = buf;
+		auto p = buf->data;
+		for (int i = 0; i < 4; ++i)
+		{
+			frame->data[i] = planes[i] > 0 ? p : nullptr;
+			frame->linesize[i] = linesize[i];
+			p += planes[i];
+		}
+		frame->extended_data = frame->data;
+
+		return 0;
+	}
+
+	int gdec::decode(const std::shared_ptr<AVPacket>& packet, const std::shared_ptr<AVFrame>& frame)
 	{
 		LOCK();
 		CHECKNOTSTOP();
 
+		return decode_packet(packet, frame);
+	}
+
+	int gdec::decode_packet(const std::shared_ptr<AVPacket>& packet, const std::shared_ptr<AVFrame>& frame)
+	{
 		if (codectx_ == nullptr)
 		{
 			CHECKFFRET(AVERROR(EINVAL));
 		}
 
-		if (packet != nullptr)
+		if (packet != nullptr && !preview_drop(packet.get()))
 		{
 			// 发送将要解码的数据
 			int ret = avcodec_send_packet(codectx_, packet.get());
@@ -120,7 +337,118 @@ namespace gff
 		return avcodec_receive_frame(codectx_, frame.get());
 	}
 
-	int gdec::decode(const void* data, uint32_t size, std::shared_ptr<AVFrame> frame, int& len)
+	int gdec::decode(const std::vector<std::shared_ptr<AVPacket>>& packets, size_t count, std::vector<std::shared_ptr<AVFrame>>& frames)
+	{
+		LOCK();
+		CHECKNOTSTOP();
+
+		if (codectx_ == nullptr || count > packets.size())
+		{
+			CHECKFFRET(AVERROR(EINVAL));
+		}
+
+		int ret = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (packets[i] == nullptr || preview_drop(packets[i].get()))
+			{
+				continue;
+			}
+			for (;;)
+			{
+				ret = avcodec_send_packet(codectx_, packets[i].get());
+				if (ret != AVERROR(EAGAIN))
+				{
+					break;
+				}
+				// 输出缓存已满, 取出帧后重新发送
+				ret = receive_frames(frames);
+				CHECKFFRET(ret);
+			}
+			CHECKFFRET(ret);
+			ret = receive_frames(frames);
+			CHECKFFRET(ret);
+		}
+
+		return 0;
+	}
+
+	int gdec::receive_frames(std::vector<std::shared_ptr<AVFrame>>& frames)
+	{
+		int ret = receive_all([&frames](const std::shared_ptr<AVFrame>& frame) {
+			frames.push_back(frame);
+			return 0;
+			});
+		return ret == AVERROR_EOF ? 0 : ret;
+	}
+
+	int gdec::decode_all(const std::shared_ptr<AVPacket>& packet, const std::function<int(const std::shared_ptr<AVFrame>& frame)>& callback)
+	{
+		LOCK();
+		CHECKNOTSTOP();
+
+		if (codectx_ == nullptr || callback == nullptr)
+		{
+			CHECKFFRET(AVERROR(EINVAL));
+		}
+
+		// 空包表示流结束
+		bool eos = packet == nullptr || (packet->data == nullptr && packet->size == 0);
+		if (!eos && preview_drop(packet.get()))
+		{
+			return receive_all(callback);
+		}
+		for (;;)
+		{
+			int ret = avcodec_send_packet(codectx_, eos ? nullptr : packet.get());
+			if (ret == AVERROR_EOF && eos)
+			{
+				// 已经在排空
+				break;
+			}
+			if (ret != AVERROR(EAGAIN))
+			{
+				CHECKFFRET(ret);
+				break;
+			}
+			// 输出缓存已满, 取出帧后重新发送
+			ret = receive_all(callback);
+			if (ret < 0)
+			{
+				return ret;
+			}
+		}
+
+		return receive_all(callback);
+	}
+
+	int gdec::receive_all(const std::function<int(const std::shared_ptr<AVFrame>& frame)>& callback)
+	{
+		for (;;)
+		{
+			// 没有帧可取时帧直接归还缓冲池, 不分配内存
+			std::shared_ptr<AVFrame> frame;
+			int ret = framepool_.get_frame(frame);
+			CHECKFFRET(ret);
+			ret = avcodec_receive_frame(codectx_, frame.get());
+			if (ret == AVERROR(EAGAIN))
+			{
+				return 0;
+			}
+			if (ret == AVERROR_EOF)
+			{
+				return ret;
+			}
+			CHECKFFRET(ret);
+			ret = callback(frame);
+			if (ret < 0)
+			{
+				return ret;
+			}
+		}
+	}
+
+	int gdec::decode(const void* data, uint32_t size, const std::shared_ptr<AVFrame>& frame, int& len)
 	{
 		LOCK();
 		CHECKNOTSTOP();
@@ -138,10 +466,86 @@ namespace gff
 		
 		if (pkt_->size > 0)
 		{
-			auto ret = decode(pkt_, frame);
+			auto ret = decode_packet(pkt_, frame);
 			CHECKFFRET(ret);
 		}
 		
 		return 0;
 	}
+
+	int gdec::flush()
+	{
+		LOCK();
+		CHECKNOTSTOP();
+
+		avcodec_flush_buffers(codectx_);
+
+		return 0;
+	}
+
+	int gdec::set_skip_frame(AVDiscard discard)
+	{
+		LOCK();
+		CHECKNOTSTOP();
+
+		skipframe_ = discard;
+		apply_skip();
+
+		return 0;
+	}
+
+	int gdec::set_preview(DECPREVIEW level, bool fast/* = true*/)
+	{
+		LOCK();
+		CHECKNOTSTOP();
+
+		preview_ = level;
+		previewfast_ = level != DECPREVIEW_NONE && fast;
+		apply_skip();
+
+		return 0;
+	}
+
+	int gdec::set_lowres(int lowres)
+	{
+		LOCK();
+		CHECKSTOP();
+
+		if (lowres < 0)
+		{
+			CHECKFFRET(AVERROR(EINVAL));
+		}
+		lowres_ = lowres;
+
+		return 0;
+	}
+
+	void gdec::apply_skip()
+	{
+		// AVDiscard越大跳过越多
+		auto discard = AVDISCARD_DEFAULT;
+		switch (preview_)
+		{
+		case DECPREVIEW_NONREF:
+			discard = AVDISCARD_NONREF;
+			break;
+		case DECPREVIEW_INTRA:
+			discard = AVDISCARD_NONINTRA;
+			break;
+		case DECPREVIEW_KEY:
+			discard = AVDISCARD_NONKEY;
+			break;
+		default:
+			break;
+		}
+		codectx_->skip_frame = FFMAX(skipframe_, discard);
+		codectx_->skip_loop_filter = previewfast_ ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+		codectx_->skip_idct = previewfast_ ? AVDISCARD_BIDIR : AVDISCARD_DEFAULT;
+	}
+
+	bool gdec::preview_drop(const AVPacket* packet) const
+	{
+		// 空包是排空, 不能丢弃
+		return preview_ == DECPREVIEW_KEY && packet->size > 0 && !(packet->flags & AV_PKT_FLAG_KEY);
+	}
 }//gff
\ No newline at end of file
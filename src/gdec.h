@@ -27,8 +27,68 @@ extern "C"
 }
 #endif
 
+#include <functional>
+
 namespace gff
 {
+    // 解码线程方式
+    typedef enum DECTHREAD
+    {
+        DECTHREAD_AUTO,     // 帧级和片级都允许, 由解码器选择, 吞吐量优先
+        DECTHREAD_FRAME,    // 帧级多线程, 吞吐量高, 每多一个线程输出多延时一帧
+        DECTHREAD_SLICE,    // 片级多线程, 不增加延时, 码流只有一个片时没有加速
+    } DECTHREAD;
+
+    // 预览解码, 用于缩略图, 场景分析和拖动预览, 输出的帧更少或质量更低
+    typedef enum DECPREVIEW
+    {
+        DECPREVIEW_NONE,    // 完整解码
+        DECPREVIEW_NONREF,  // 跳过不被参考的帧
+        DECPREVIEW_INTRA,   // 只解码帧内编码的帧
+        DECPREVIEW_KEY,     // 只解码关键帧, 非关键帧的包不送入解码器
+    } DECPREVIEW;
+
+    // 解码帧数据缓冲区分配接口, 用于视频解码器的get_buffer2
+    // 解码器开启帧级多线程时会在多个线程中同时调用
+    class gframeallocator
+    {
+    public:
+        virtual ~gframeallocator() = default;
+
+        /*
+         * @brief           分配数据缓冲区
+         * @return          带引用计数的缓冲区, 失败返回空, 数据地址需要至少64字节对齐
+         *                  最后一个引用释放时由缓冲区的free回调回收, 可能晚于分配器和解码器的销毁
+         * @param size[in]  大小, 已包含对齐和填充
+        */
+        virtual AVBufferRef* alloc(int size) = 0;
+    };
+
+    // 按大小分组的AVBufferPool分配器, 分辨率不变时解码不再分配内存
+    class gpoolallocator : public gframeallocator
+    {
+    public:
+        ~gpoolallocator();
+
+        AVBufferRef* alloc(int size) override;
+
+        /*
+         * @brief               获取统计
+         * @param hits[out]     复用次数
+         * @param misses[out]   新分配次数
+        */
+        void get_stats(uint64_t& hits, uint64_t& misses);
+
+    private:
+        // AVBufferPool的分配回调
+        static AVBufferRef* pool_alloc(void* opaque, int size);
+
+        std::mutex mutex_;
+        std::map<int, AVBufferPool*> pools_;
+        std::atomic<uint64_t> gets_{ 0 };
+        std::atomic<uint64_t> misses_{ 0 };
+    };
+
     class gdec : public gavbase
     {
     public:
@@ -45,8 +105,26 @@ namespace gff
          * @return              错误码
          * @param par[in]       解码器参数
          * @param hwtype[in]    硬解类型
+         * @param dicts[in]     解码器选项键值对, 在线程设置之后生效(例如threads)
+        */
+        int copy_param(const AVCodecParameters* par, AVHWDeviceType hwtype = AV_HWDEVICE_TYPE_NONE,
+            const std::vector<std::pair<std::string, std::string>>& dicts = {});
+
+        /*
+         * @brief               设置解码线程, 在copy_param之前调用, 未设置时单线程解码
+         * @return              错误码
+         * @param type[in]      线程方式
+         * @param count[in]     线程数, 0为按CPU核数自动选择, 1为单线程
+        */
+        int set_threads(DECTHREAD type, int count = 0);
+
+        /*
+         * @brief               设置视频帧数据的分配器, 在copy_param之前调用
+         *                      解码器不支持直接渲染(AV_CODEC_CAP_DR1)或使用硬解时仍由ffmpeg分配
+         * @return              错误码
+         * @param allocator[in] 分配器, 为空时恢复默认
         */
-        int copy_param(const AVCodecParameters* par, AVHWDeviceType hwtype = AV_HWDEVICE_TYPE_NONE);
+        int set_allocator(const std::shared_ptr<gframeallocator>& allocator);
 
         /*
          * @brief               解码一个AVPacket包
@@ -54,7 +132,26 @@ namespace gff
          * @param packet[in]    数据包
          * @param frame[out]    结果AVFrame
         */
-        int decode(std::shared_ptr<AVPacket> packet, std::shared_ptr<AVFrame> frame);
+        int decode(const std::shared_ptr<AVPacket>& packet, const std::shared_ptr<AVFrame>& frame);
+
+        /*
+         * @brief               批量解码, 整批只加锁一次, 每个包产生的帧都会取出
+         * @return              错误码
+         * @param packets[in]   同一个流的数据包, 空指针被忽略, 空包表示流结束
+         * @param count[in]     使用packets开头的个数
+         * @param frames[out]   追加解码得到的帧, 帧来自解码器内部的缓冲池
+        */
+        int decode(const std::vector<std::shared_ptr<AVPacket>>& packets, size_t count, std::vector<std::shared_ptr<AVFrame>>& frames);
+
+        /*
+         * @brief               送入一个包并通过回调输出所有可以输出的帧, 不需要再循环decode(nullptr, frame)
+         *                      packet为空指针或空包时排空解码器, 之后需要flush才能继续解码
+         * @return              错误码, 送入的包已处理且取完输出返回0, 排空结束返回AVERROR_EOF
+         *                      回调返回负数时停止并返回该值, 剩余的帧在下次调用时输出
+         * @param packet[in]    数据包
+         * @param callback[in]  接收帧, 帧来自解码器内部的缓冲池, 回调之后仍要使用时保留shared_ptr
+        */
+        int decode_all(const std::shared_ptr<AVPacket>& packet, const std::function<int(const std::shared_ptr<AVFrame>& frame)>& callback);
 
         /*
          * @brief               解码裸流数据
@@ -64,12 +161,73 @@ namespace gff
          * @param frame[out]    结果AVFrame
          * @param len[out]      已经处理的数据长度
         */
-        int decode(const void* data, uint32_t size, std::shared_ptr<AVFrame> frame, int& len);
+        int decode(const void* data, uint32_t size, const std::shared_ptr<AVFrame>& frame, int& len);
+
+        /*
+         * @brief   清空解码器内部缓存的帧和参考帧, 跳转后调用
+         * @return  错误码
+        */
+        int flush();
+
+        /*
+         * @brief               设置跳过的帧类型, 对之后送入的包生效
+         * @return              错误码
+         * @param discard[in]   AVDISCARD_NONREF跳过不被参考的帧, AVDISCARD_DEFAULT恢复
+        */
+        int set_skip_frame(AVDiscard discard);
+
+        /*
+         * @brief               设置预览解码, 随时切换, 对之后送入的包生效, 不重新打开解码器
+         *                      与set_skip_frame同时设置时按跳过较多的生效
+         * @return              错误码
+         * @param level[in]     跳过的帧
+         * @param fast[in]      是否同时跳过环路滤波和B帧的反变换, 解码的帧质量下降
+        */
+        int set_preview(DECPREVIEW level, bool fast = true);
+
+        /*
+         * @brief               设置低分辨率解码, 在copy_param之前调用, 输出宽高缩小为1/2^lowres
+         *                      超过解码器支持的级别时取最大级别, 不支持的解码器(例如h264)不生效
+         * @return              错误码
+         * @param lowres[in]    级别, 0为原始分辨率
+        */
+        int set_lowres(int lowres);
 
     private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
+        // 解码一个AVPacket包, 调用前需已加锁
+        int decode_packet(const std::shared_ptr<AVPacket>& packet, const std::shared_ptr<AVFrame>& frame);
+
+        // 取出解码器中所有可以输出的帧, 调用前需已加锁
+        int receive_frames(std::vector<std::shared_ptr<AVFrame>>& frames);
+
+        // 逐个取出帧交给回调, 需要输入时返回0, 排空结束返回AVERROR_EOF, 调用前需已加锁
+        int receive_all(const std::function<int(const std::shared_ptr<AVFrame>& frame)>& callback);
+
+        // 按set_skip_frame和预览设置跳过选项, 调用前需已加锁
+        void apply_skip();
+
+        // 预览模式下是否不送入解码器
+        bool preview_drop(const AVPacket* packet) const;
+
+        // AVCodecContext::get_buffer2回调, opaque为分配器
+        static int get_buffer(AVCodecContext* ctx, AVFrame* frame, int flags);
+
+        DECTHREAD threadtype_ = DECTHREAD_AUTO;
+        int threadcount_ = 1;
+        std::shared_ptr<gframeallocator> allocator_;
+        int lowres_ = 0;
+
+        AVDiscard skipframe_ = AVDISCARD_DEFAULT;
+        DECPREVIEW preview_ = DECPREVIEW_NONE;
+        bool previewfast_ = false;
+
         AVCodecContext* codectx_ = nullptr;
         AVCodecParserContext* par_ = nullptr;
         std::shared_ptr<AVPacket> pkt_ = GetPacket();
+        gframepool framepool_;
     };
 }//gff
 
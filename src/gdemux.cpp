@@ -12,6 +12,21 @@
 
 #include "gdemux.h"
 #include "gutil.h"
+#include "gstreaminfo.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <libavutil/time.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <algorithm>
+#include <climits>
 
 namespace gff
 {
@@ -20,14 +35,247 @@ namespace gff
         cleanup();
     }
 
+    gmemio::gmemio(const uint8_t* data, int64_t size)
+        : data_(data), size_(size)
+    {
+    }
+
+    int gmemio::read(uint8_t* buf, int size)
+    {
+        auto left = size_ - pos_;
+        if (left <= 0)
+        {
+            return AVERROR_EOF;
+        }
+        auto len = size < left ? size : static_cast<int>(left);
+        memcpy(buf, data_ + pos_, len);
+        pos_ += len;
+        return len;
+    }
+
+    int64_t gmemio::seek(int64_t pos)
+    {
+        if (pos < 0 || pos > size_)
+        {
+            return AVERROR(EINVAL);
+        }
+        pos_ = pos;
+        return pos_;
+    }
+
+    int64_t gmemio::size()
+    {
+        return size_;
+    }
+
+    int gdemux::io_read(void* opaque, uint8_t* buf, int buf_size)
+    {
+        auto in = static_cast<ioinput*>(opaque);
+        int ret = in->io->read(buf, buf_size);
+        if (ret > 0)
+        {
+            in->pos += ret;
+        }
+        return ret;
+    }
+
+    int64_t gdemux::io_seek(void* opaque, int64_t offset, int whence)
+    {
+        auto in = static_cast<ioinput*>(opaque);
+        int64_t pos = 0;
+        switch (whence & ~AVSEEK_FORCE)
+        {
+        case AVSEEK_SIZE:
+            return in->io->size();
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = in->pos + offset;
+            break;
+        case SEEK_END:
+            pos = in->io->size();
+            if (pos < 0)
+            {
+                return pos;
+            }
+            pos += offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+        }
+
+        pos = in->io->seek(pos);
+        if (pos >= 0)
+        {
+            in->pos = pos;
+        }
+        return pos;
+    }
+
     int gdemux::open(const char* in, const char* fmt/* = nullptr*/, const std::vector<std::pair<std::string, std::string>>& dicts/* = {}*/,
-        int (*read_packet)(void* opaque, uint8_t* buf, int buf_size)/* = nullptr*/, void* opaque/* = nullptr*/, size_t bufsize/* = 1024*/)
+        int (*read_packet)(void* opaque, uint8_t* buf, int buf_size)/* = nullptr*/, void* opaque/* = nullptr*/, size_t bufsize/* = GDEMUX_AVIO_BUFSIZE*/,
+        int64_t(*seek)(void* opaque, int64_t offset, int whence)/* = nullptr*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        return open_input(in, fmt, dicts, read_packet, seek, opaque, bufsize, false);
+    }
+
+    // 快速打开时探测的数据量和时长
+    static const int64_t FAST_PROBESIZE = 128 * 1024;
+    static const int64_t FAST_ANALYZEDURATION = AV_TIME_BASE / 2;
+    // 实时输入探测的数据量和时长
+    static const int64_t LIVE_PROBESIZE = 32 * 1024;
+    static const int64_t LIVE_ANALYZEDURATION = AV_TIME_BASE / 10;
+
+    int gdemux::set_open_profile(OPENPROFILE profile)
     {
         LOCK();
         CHECKSTOP();
+
+        profile_ = profile;
+
+        return 0;
+    }
+
+    int gdemux::set_info_cache(const char* dir)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        infocache_ = dir != nullptr ? dir : "";
+
+        return 0;
+    }
+
+    int gdemux::set_cancel_token(const std::shared_ptr<gcanceltoken>& token)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        interrupt_.set_token(token);
+
+        return 0;
+    }
+
+    int gdemux::set_io_timeout(int64_t timeoutus)
+    {
+        // 只修改原子变量, 不加对象锁
+        interrupt_.set_timeout(timeoutus);
+
+        return 0;
+    }
+
+    int gdemux::cancel()
+    {
+        // 阻塞的调用持有对象锁, 不能加锁
+        interrupt_.cancel();
+
+        return 0;
+    }
+
+    int gdemux::open_io(gdemuxio* io, const char* in/* = nullptr*/, const char* fmt/* = nullptr*/,
+        const std::vector<std::pair<std::string, std::string>>& dicts/* = {}*/, size_t bufsize/* = GDEMUX_AVIO_BUFSIZE*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        if (io == nullptr)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+        ioinput_.io = io;
+        ioinput_.pos = 0;
+
+        // 不支持跳转时不设置回调, avio只在缓冲区内跳转
+        return open_input(in, fmt, dicts, io_read, io->seekable() ? io_seek : nullptr, &ioinput_, bufsize, false);
+    }
+
+    int gdemux::open_mmap(const char* in, const char* fmt/* = nullptr*/, const std::vector<std::pair<std::string, std::string>>& dicts/* = {}*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        const uint8_t* data = nullptr;
+        int64_t size = 0;
+        int ret = mmap_.open(in);
+        CHECKFFRET(ret);
+        ret = mmap_.get_data(data, size);
+        CHECKFFRET(ret);
+        memio_.reset(new gmemio(data, size));
+        ioinput_.io = memio_.get();
+        ioinput_.pos = 0;
+
+        // 格式探测仍然使用文件名, 大块读取直接从映射拷贝到目标
+        return open_input(in, fmt, dicts, io_read, io_seek, &ioinput_, GDEMUX_AVIO_BUFSIZE, true);
+    }
+
+    // 内存探测的最大长度
+    static const int64_t MEMORY_PROBESIZE = 1 << 20;
+
+    // 直接在内存上探测格式, 不够确定时返回空, 由avformat_open_input继续探测
+    static AVInputFormat* probe_memory(const uint8_t* data, int64_t size, const char* in)
+    {
+        AVProbeData pd = { 0 };
+        pd.filename = in != nullptr ? in : "";
+        std::vector<uint8_t> padded;
+        if (size >= MEMORY_PROBESIZE + AVPROBE_PADDING_SIZE)
+        {
+            // 探测数据之后还有足够的数据, 不需要补零
+            pd.buf = const_cast<uint8_t*>(data);
+            pd.buf_size = static_cast<int>(MEMORY_PROBESIZE);
+        }
+        else
+        {
+            padded.assign(data, data + size);
+            padded.resize(static_cast<size_t>(size) + AVPROBE_PADDING_SIZE, 0);
+            pd.buf = padded.data();
+            pd.buf_size = static_cast<int>(size);
+        }
+
+        int score = AVPROBE_SCORE_RETRY;
+        return av_probe_input_format2(&pd, 1, &score);
+    }
+
+    int gdemux::open_memory(const uint8_t* data, int64_t size, const char* in/* = nullptr*/, const char* fmt/* = nullptr*/,
+        const std::vector<std::pair<std::string, std::string>>& dicts/* = {}*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        if (data == nullptr || size <= 0)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+        memio_.reset(new gmemio(data, size));
+        ioinput_.io = memio_.get();
+        ioinput_.pos = 0;
+
+        if (fmt == nullptr)
+        {
+            infmt_ = probe_memory(data, size, in);
+        }
+
+        // 大块读取直接从内存拷贝到目标, 不经过avio缓冲区
+        return open_input(in, fmt, dicts, io_read, io_seek, &ioinput_, GDEMUX_AVIO_BUFSIZE, true);
+    }
+
+    int gdemux::open_input(const char* in, const char* fmt, const std::vector<std::pair<std::string, std::string>>& dicts,
+        int (*read_packet)(void* opaque, uint8_t* buf, int buf_size), int64_t(*seek)(void* opaque, int64_t offset, int whence),
+        void* opaque, size_t bufsize, bool direct)
+    {
         int ret = 0;
 
-        cleanup();
         avdevice_register_all();
 
         if (fmt != nullptr && 
@@ -52,6 +300,7 @@ namespace gff
         {
             CHECKFFRET(AVERROR(ENOMEM));
         }
+        fmtctx_->interrupt_callback = interrupt_.get_callback();
 
         if (read_packet != nullptr)
         {
@@ -60,52 +309,375 @@ namespace gff
             {
                 CHECKFFRET(AVERROR(ENOMEM));
             }
-            auto avioctx = avio_alloc_context(aviobuf, bufsize, 0, opaque, read_packet, nullptr, nullptr);
-            if (avioctx == nullptr)
+            avio_ = avio_alloc_context(aviobuf, static_cast<int>(bufsize), 0, opaque, read_packet, nullptr, seek);
+            if (avio_ == nullptr)
             {
+                av_free(aviobuf);
                 CHECKFFRET(AVERROR(ENOMEM));
             }
-            fmtctx_->pb = avioctx;
+            // 大块读取不经过avio缓冲区
+            avio_->direct = direct || profile_ == OPEN_LIVE ? 1 : 0;
+            fmtctx_->pb = avio_;
         }
         
+        if (profile_ == OPEN_FAST)
+        {
+            fmtctx_->probesize = FAST_PROBESIZE;
+            fmtctx_->max_analyze_duration = FAST_ANALYZEDURATION;
+        }
+        else if (profile_ == OPEN_LIVE)
+        {
+            fmtctx_->probesize = LIVE_PROBESIZE;
+            fmtctx_->max_analyze_duration = LIVE_ANALYZEDURATION;
+            // 不等待乱序的包
+            fmtctx_->max_delay = 0;
+            // 探测时读到的包不进入缓冲, 协议层不使用avio缓冲区
+            fmtctx_->flags |= AVFMT_FLAG_NOBUFFER;
+            fmtctx_->avio_flags |= AVIO_FLAG_DIRECT;
+        }
+
+        interrupt_.begin();
         ret = avformat_open_input(&fmtctx_, in, infmt_, &dict_);
+        interrupt_.end();
         CHECKFFRET(ret);
+        url_ = in != nullptr ? in : "";
 
-        ret = avformat_find_stream_info(fmtctx_, nullptr);
-        CHECKFFRET(ret);
+        // 缓存命中时不再探测, 只对本地文件有效
+        bool usecache = !infocache_.empty() && in != nullptr && profile_ != OPEN_LIVE;
+        bool cached = usecache &&
+            LoadStreamInfo(infocache_.c_str(), in, fmtctx_) == 0;
+        if (!cached)
+        {
+            interrupt_.begin();
+            ret = avformat_find_stream_info(fmtctx_, nullptr);
+            interrupt_.end();
+            CHECKFFRET(ret);
+            if (usecache)
+            {
+                SaveStreamInfo(infocache_.c_str(), in, fmtctx_);
+            }
+        }
 
-        av_dump_format(fmtctx_, -1, in, 0);
+        if (profile_ == OPEN_DEFAULT)
+        {
+            av_dump_format(fmtctx_, -1, in, 0);
+        }
+        arrival_.reset();
 
         getstatus() = WORKING;
 
         return ret;
     }
 
-    int gdemux::readpacket(std::shared_ptr<AVPacket> packet)
+    int gdemux::readpacket(const std::shared_ptr<AVPacket>& packet)
     {
         LOCK();
         CHECKNOTSTOP();
 
-        // 解引用
-        av_packet_unref(packet.get());
-        
-        return av_read_frame(fmtctx_, packet.get());
+        size_t count = 0;
+        return read_packets(&packet, 1, 0, count);
+    }
+
+    int gdemux::readpackets(const std::vector<std::shared_ptr<AVPacket>>& packets, size_t& count, size_t maxbytes/* = 0*/)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        count = 0;
+        for (const auto& packet : packets)
+        {
+            if (packet == nullptr)
+            {
+                CHECKFFRET(AVERROR(EINVAL));
+            }
+        }
+        if (packets.empty())
+        {
+            return 0;
+        }
+
+        return read_packets(packets.data(), packets.size(), maxbytes, count);
+    }
+
+    int gdemux::read_packets(const std::shared_ptr<AVPacket>* packets, size_t size, size_t maxbytes, size_t& count)
+    {
+        count = 0;
+        size_t bytes = 0;
+
+        if (!rathread_.joinable())
+        {
+            int ret = 0;
+            while (count < size && (maxbytes == 0 || bytes < maxbytes))
+            {
+                // 解引用
+                av_packet_unref(packets[count].get());
+                auto begin = av_gettime_relative();
+                interrupt_.begin();
+                ret = av_read_frame(fmtctx_, packets[count].get());
+                interrupt_.end();
+                if (ret < 0)
+                {
+                    break;
+                }
+                // 直接读取时记录在av_read_frame中等待数据的时间
+                arrival_.record(av_gettime_relative() - begin);
+                normalize(packets[count].get());
+                bytes += packets[count]->size;
+                ++count;
+            }
+            return count > 0 ? 0 : ret;
+        }
+
+        std::unique_lock<std::mutex> lck(ramutex_);
+        if (raqueue_.empty() && raret_ == 0)
+        {
+            ++raunderruns_;
+            racv_.wait(lck, [this]() { return !raqueue_.empty() || raret_ != 0; });
+        }
+
+        // 只等待第一个包, 之后只取缓冲中已有的
+        auto now = av_gettime_relative();
+        while (count < size && !raqueue_.empty() && (maxbytes == 0 || bytes < maxbytes))
+        {
+            auto& item = raqueue_.front();
+            auto& packet = packets[count];
+            av_packet_unref(packet.get());
+            rabytes_ -= item.packet->size;
+            bytes += item.packet->size;
+            av_packet_move_ref(packet.get(), item.packet.get());
+            normalize(packet.get());
+            arrival_.record(now - item.arrival);
+            raqueue_.pop_front();
+            ++rareads_;
+            ++count;
+        }
+        if (count == 0)
+        {
+            // 输入结束或出错
+            av_packet_unref(packets[0].get());
+            return raret_;
+        }
+        racv_.notify_all();
+
+        return 0;
+    }
+
+    int gdemux::start_readahead(size_t maxbytes/* = 8 * 1024 * 1024*/, int64_t maxduration/* = 0*/)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        if (maxbytes == 0)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+
+        readahead_stop();
+        {
+            std::lock_guard<std::mutex> lck(ramutex_);
+            rareads_ = 0;
+            raunderruns_ = 0;
+        }
+
+        return readahead_start(maxbytes, maxduration);
+    }
+
+    int gdemux::stop_readahead()
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        readahead_stop();
+        {
+            std::lock_guard<std::mutex> lck(ramutex_);
+            ramaxbytes_ = 0;
+            ramaxduration_ = 0;
+        }
+
+        return 0;
+    }
+
+    int gdemux::get_readahead_stats(greadaheadstats& stats)
+    {
+        // 不加对象锁, readpacket等待预读时也能返回
+        std::lock_guard<std::mutex> lck(ramutex_);
+        stats.packets = raqueue_.size();
+        stats.bytes = rabytes_;
+        stats.durationus = raqueue_.size() > 1 ? raqueue_.back().dtsus - raqueue_.front().dtsus : 0;
+        stats.fullness = ramaxbytes_ > 0 ? static_cast<double>(rabytes_) / ramaxbytes_ : 0;
+        if (ramaxduration_ > 0 && static_cast<double>(stats.durationus) / ramaxduration_ > stats.fullness)
+        {
+            stats.fullness = static_cast<double>(stats.durationus) / ramaxduration_;
+        }
+        stats.reads = rareads_;
+        stats.underruns = raunderruns_;
+
+        return 0;
+    }
+
+    int gdemux::set_normalize(bool enable, AVRational timebase/* = { 1, AV_TIME_BASE }*/, int64_t threshold/* = 10 * AV_TIME_BASE*/)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        if (enable && (timebase.num <= 0 || timebase.den <= 0 || threshold <= 0))
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+
+        normalize_ = enable;
+        normtb_ = timebase;
+        normthreshold_ = av_rescale_q(threshold, { 1, AV_TIME_BASE }, timebase);
+        normorigin_ = AV_NOPTS_VALUE;
+        normalize_reset();
+
+        return 0;
+    }
+
+    int gdemux::get_arrival_stats(glatencystats& stats)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        return arrival_.get_stats(stats);
+    }
+
+    int gdemux::readahead_start(size_t maxbytes, int64_t maxduration)
+    {
+        {
+            std::lock_guard<std::mutex> lck(ramutex_);
+            ramaxbytes_ = maxbytes;
+            ramaxduration_ = maxduration;
+        }
+        rastop_ = false;
+        raret_ = 0;
+        rathread_ = std::thread(&gdemux::readahead_run, this);
+
+        return 0;
+    }
+
+    void gdemux::readahead_stop(bool drop/* = true*/)
+    {
+        if (!rathread_.joinable())
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lck(ramutex_);
+            rastop_ = true;
+            racv_.notify_all();
+        }
+        // 缓冲要丢弃时中断正在阻塞的读取
+        if (drop)
+        {
+            interrupt_.abort();
+        }
+        rathread_.join();
+        interrupt_.resume();
+
+        if (drop)
+        {
+            std::lock_guard<std::mutex> lck(ramutex_);
+            raqueue_.clear();
+            rabytes_ = 0;
+        }
+    }
+
+    bool gdemux::readahead_full() const
+    {
+        // 至少缓冲一个包
+        if (raqueue_.empty())
+        {
+            return false;
+        }
+        if (rabytes_ >= ramaxbytes_)
+        {
+            return true;
+        }
+        return ramaxduration_ > 0 && raqueue_.back().dtsus - raqueue_.front().dtsus >= ramaxduration_;
+    }
+
+    void gdemux::readahead_run()
+    {
+        // 运行期间只有本线程访问fmtctx_的读取状态, 跳转和清理会先停止本线程
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lck(ramutex_);
+                racv_.wait(lck, [this]() { return rastop_ || !readahead_full(); });
+                if (rastop_)
+                {
+                    break;
+                }
+            }
+
+            std::shared_ptr<AVPacket> packet;
+            int ret = rapool_.get_packet(packet);
+            if (ret == 0)
+            {
+                interrupt_.begin();
+                ret = av_read_frame(fmtctx_, packet.get());
+                interrupt_.end();
+            }
+            if (ret == AVERROR(EAGAIN))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lck(ramutex_);
+            if (ret < 0)
+            {
+                raret_ = ret;
+                racv_.notify_all();
+                break;
+            }
+
+            auto ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+            auto dtsus = ts == AV_NOPTS_VALUE ? (raqueue_.empty() ? 0 : raqueue_.back().dtsus) :
+                av_rescale_q(ts, fmtctx_->streams[packet->stream_index]->time_base, { 1, AV_TIME_BASE });
+            rabytes_ += packet->size;
+            raqueue_.push_back({ std::move(packet), dtsus, av_gettime_relative() });
+            racv_.notify_all();
+        }
     }
 
     int gdemux::cleanup()
     {
         LOCK();
 
-        if (fmtctx_ != nullptr && 
-            fmtctx_->pb != nullptr) 
+        return release();
+    }
+
+    int gdemux::release()
+    {
+        readahead_stop();
+        {
+            std::lock_guard<std::mutex> lck(ramutex_);
+            ramaxbytes_ = 0;
+            ramaxduration_ = 0;
+        }
+
+        // 自定义输入的avio不会被avformat_close_input释放
+        avformat_close_input(&fmtctx_);
+        if (avio_ != nullptr)
         {
             // 清理avio相关资源
-            av_freep(&fmtctx_->pb->buffer);
-            av_freep(&fmtctx_->pb);
+            av_freep(&avio_->buffer);
+            avio_context_free(&avio_);
         }
-        avformat_close_input(&fmtctx_); 
+        ioinput_ = ioinput();
+        memio_.reset();
+        mmap_.cleanup();
         av_dict_free(&dict_);
         infmt_ = nullptr;
+        url_.clear();
+        indexes_.clear();
+        interrupt_.reset();
+        normalize_ = false;
+        normorigin_ = AV_NOPTS_VALUE;
+        normalize_reset();
         getstatus() = STOP;
 
         return 0;
@@ -159,6 +731,56 @@ namespace gff
         return 0;
     }
 
+    int gdemux::select_streams(const std::vector<unsigned int>& indexes)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        for (auto index : indexes)
+        {
+            if (index >= fmtctx_->nb_streams)
+            {
+                CHECKFFRET(AVERROR(EINVAL));
+            }
+        }
+
+        // 预读线程会读取discard, 先停止, 已缓冲的包保留
+        auto readahead = rathread_.joinable();
+        readahead_stop(false);
+
+        std::vector<bool> selected(fmtctx_->nb_streams, indexes.empty());
+        for (auto index : indexes)
+        {
+            selected[index] = true;
+        }
+        for (unsigned int i = 0; i < fmtctx_->nb_streams; ++i)
+        {
+            fmtctx_->streams[i]->discard = selected[i] ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        }
+
+        if (readahead)
+        {
+            {
+                std::lock_guard<std::mutex> lck(ramutex_);
+                for (auto it = raqueue_.begin(); it != raqueue_.end();)
+                {
+                    if (selected[it->packet->stream_index])
+                    {
+                        ++it;
+                    }
+                    else
+                    {
+                        rabytes_ -= it->packet->size;
+                        it = raqueue_.erase(it);
+                    }
+                }
+            }
+            readahead_start(ramaxbytes_, ramaxduration_);
+        }
+
+        return 0;
+    }
+
     int gdemux::seek_frame(int index, int64_t timestamp, bool seekanyframe)
     {
         LOCK();
@@ -169,14 +791,21 @@ namespace gff
             CHECKFFRET(AVERROR(EINVAL));
         }
          
-        if (seekanyframe)
-        {
-            return av_seek_frame(fmtctx_, index, timestamp, AVSEEK_FLAG_ANY);
-        }
-        else
+        // 预读的包在跳转后无效
+        auto readahead = rathread_.joinable();
+        readahead_stop();
+
+        interrupt_.begin();
+        int ret = av_seek_frame(fmtctx_, index, timestamp, seekanyframe ? AVSEEK_FLAG_ANY : AVSEEK_FLAG_BACKWARD);
+        interrupt_.end();
+        normalize_reset();
+
+        if (readahead)
         {
-            return av_seek_frame(fmtctx_, index, timestamp, AVSEEK_FLAG_BACKWARD);
+            readahead_start(ramaxbytes_, ramaxduration_);
         }
+
+        return ret;
     }
 
     int gdemux::get_duration(int64_t& duration, AVRational timebase)
@@ -188,4 +817,423 @@ namespace gff
 
         return 0;
     }
-}//gff
+
+    int gdemux::build_index(int index, const char* indexpath/* = nullptr*/)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        if (index < 0 || static_cast<unsigned int>(index) >= fmtctx_->nb_streams)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+
+        std::string path = indexpath != nullptr ? indexpath : "";
+        if (path.empty() && !url_.empty())
+        {
+            if (!infocache_.empty())
+            {
+                GetStreamInfoPath(infocache_.c_str(), url_.c_str(), ".gidx", path);
+            }
+            else
+            {
+                path = url_ + ".gidx";
+            }
+        }
+
+        std::vector<gindexentry> entries;
+        if (path.empty() || LoadStreamIndex(path.c_str(), url_.c_str(), index, entries) < 0)
+        {
+            if (!index_from_container(index, entries))
+            {
+                int ret = index_scan(index, entries);
+                CHECKFFRET(ret);
+            }
+            if (!path.empty())
+            {
+                // 不是本地文件或目录不可写时只在内存中使用
+                SaveStreamIndex(path.c_str(), url_.c_str(), index, entries);
+            }
+        }
+        index_set(index, std::move(entries));
+
+        return 0;
+    }
+
+    int gdemux::get_index(int index, std::vector<gindexentry>& entries)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        auto it = indexes_.find(index);
+        if (it == indexes_.end())
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+        entries = it->second.entries;
+
+        return 0;
+    }
+
+    int gdemux::find_index(int index, int64_t timestamp, gindexseek& result)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        return index_lookup(index, timestamp, result);
+    }
+
+    int gdemux::seek_index(int index, int64_t timestamp, gindexseek& result)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        int ret = index_lookup(index, timestamp, result);
+        CHECKFFRET(ret);
+
+        auto readahead = rathread_.joinable();
+        readahead_stop();
+
+        ret = AVERROR(ENOSYS);
+        interrupt_.begin();
+        // 只对时间戳可能不连续的格式(ts, ps)按字节跳转, 与ffmpeg工具相同
+        // 其他格式(例如mkv的cluster内部)按字节跳转后需要重新同步, 可能越过目标关键帧
+        if (result.keypos >= 0 && (fmtctx_->iformat->flags & AVFMT_TS_DISCONT) &&
+            !(fmtctx_->iformat->flags & AVFMT_NO_BYTE_SEEK))
+        {
+            ret = av_seek_frame(fmtctx_, index, result.keypos, AVSEEK_FLAG_BYTE);
+        }
+        if (ret < 0)
+        {
+            // 按关键帧的dts跳转, 索引中的关键帧同样是容器的跳转点
+            auto ts = result.keydts != AV_NOPTS_VALUE ? result.keydts : result.keypts;
+            ret = av_seek_frame(fmtctx_, index, ts, AVSEEK_FLAG_BACKWARD);
+        }
+        interrupt_.end();
+        normalize_reset();
+
+        if (readahead)
+        {
+            readahead_start(ramaxbytes_, ramaxduration_);
+        }
+
+        return ret;
+    }
+
+    int gdemux::index_lookup(int index, int64_t timestamp, gindexseek& result)
+    {
+        auto it = indexes_.find(index);
+        if (it == indexes_.end() || it->second.keys.empty() || it->second.bypts.empty())
+        {
+            // 没有索引是正常情况, 由调用者决定是否改用其他方式
+            return AVERROR(ENOENT);
+        }
+        const auto& idx = it->second;
+
+        // 显示时间不晚于timestamp的最后一帧, 都晚于时取第一帧
+        auto target = std::upper_bound(idx.bypts.begin(), idx.bypts.end(), std::make_pair(timestamp, INT_MAX));
+        if (target != idx.bypts.begin())
+        {
+            --target;
+        }
+        auto decidx = target->second;
+
+        // 解码顺序上不晚于目标帧的最后一个关键帧
+        auto key = std::upper_bound(idx.keys.begin(), idx.keys.end(), decidx);
+        if (key == idx.keys.begin())
+        {
+            // 目标帧在第一个关键帧之前, 无法解码, 改为第一个关键帧
+            decidx = idx.keys.front();
+        }
+        else
+        {
+            --key;
+        }
+        const auto& targetentry = idx.entries[decidx];
+        auto targetpts = targetentry.pts != AV_NOPTS_VALUE ? targetentry.pts : targetentry.dts;
+        auto entrypts = [&idx](int i) {
+            const auto& e = idx.entries[i];
+            return e.pts != AV_NOPTS_VALUE ? e.pts : e.dts;
+        };
+        // 开放GOP中关键帧之后显示在它之前的帧参考上一个GOP, 需要从上一个关键帧开始解码
+        while (key != idx.keys.begin() && targetpts < entrypts(*key))
+        {
+            --key;
+        }
+        auto keyidx = *key;
+        const auto& keyentry = idx.entries[keyidx];
+        auto keypts = entrypts(keyidx);
+
+        result.keypts = keypts;
+        result.keydts = keyentry.dts;
+        result.keypos = keyentry.pos;
+        result.targetpts = targetpts;
+        result.decodes = decidx - keyidx + 1;
+        // 关键帧之后输出的帧按pts排序, 目标帧之前的都要丢弃
+        result.skips = static_cast<int>(
+            std::lower_bound(idx.bypts.begin(), idx.bypts.end(), std::make_pair(targetpts, INT_MIN)) -
+            std::lower_bound(idx.bypts.begin(), idx.bypts.end(), std::make_pair(keypts, INT_MIN)));
+        if (result.skips < 0)
+        {
+            // 第一个关键帧之前没有可以回退的GOP, 它的前导帧无法解码
+            result.skips = 0;
+        }
+
+        return 0;
+    }
+
+    bool gdemux::index_from_container(int index, std::vector<gindexentry>& entries)
+    {
+        // 只有容器为每一帧建立了索引且没有重排序(pts等于dts)时才能直接使用, 例如mp4
+        auto st = fmtctx_->streams[index];
+        if (st->nb_index_entries <= 0 || st->nb_frames != st->nb_index_entries ||
+            st->codecpar->video_delay != 0)
+        {
+            return false;
+        }
+
+        entries.clear();
+        entries.reserve(st->nb_index_entries);
+        for (int i = 0; i < st->nb_index_entries; ++i)
+        {
+            const auto& e = st->index_entries[i];
+            gindexentry entry;
+            entry.pts = e.timestamp;
+            entry.dts = e.timestamp;
+            entry.pos = e.pos;
+            entry.size = e.size;
+            entry.flags = (e.flags & AVINDEX_KEYFRAME) ? AV_PKT_FLAG_KEY : 0;
+            entries.push_back(entry);
+        }
+
+        return true;
+    }
+
+    int gdemux::index_scan(int index, std::vector<gindexentry>& entries)
+    {
+        auto readahead = rathread_.joinable();
+        readahead_stop();
+
+        // 扫描时丢弃其他流, 结束后恢复
+        std::vector<AVDiscard> discards(fmtctx_->nb_streams);
+        for (unsigned int i = 0; i < fmtctx_->nb_streams; ++i)
+        {
+            discards[i] = fmtctx_->streams[i]->discard;
+            if (i != static_cast<unsigned int>(index))
+            {
+                fmtctx_->streams[i]->discard = AVDISCARD_ALL;
+            }
+        }
+
+        auto st = fmtctx_->streams[index];
+        auto start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+        interrupt_.begin();
+        int ret = av_seek_frame(fmtctx_, index, start, AVSEEK_FLAG_BACKWARD);
+        interrupt_.end();
+        entries.clear();
+        AVPacket packet;
+        av_init_packet(&packet);
+        packet.data = nullptr;
+        packet.size = 0;
+        while (ret >= 0)
+        {
+            interrupt_.begin();
+            ret = av_read_frame(fmtctx_, &packet);
+            interrupt_.end();
+            if (ret == AVERROR(EAGAIN))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                ret = 0;
+                continue;
+            }
+            if (ret < 0)
+            {
+                break;
+            }
+            if (packet.stream_index == index)
+            {
+                gindexentry entry;
+                entry.pts = packet.pts;
+                entry.dts = packet.dts;
+                entry.pos = packet.pos;
+                entry.size = packet.size;
+                entry.flags = packet.flags;
+                entries.push_back(entry);
+            }
+            av_packet_unref(&packet);
+        }
+
+        for (unsigned int i = 0; i < fmtctx_->nb_streams; ++i)
+        {
+            fmtctx_->streams[i]->discard = discards[i];
+        }
+        if (ret == AVERROR_EOF)
+        {
+            interrupt_.begin();
+            ret = av_seek_frame(fmtctx_, index, start, AVSEEK_FLAG_BACKWARD);
+            interrupt_.end();
+        }
+        normalize_reset();
+
+        if (readahead)
+        {
+            readahead_start(ramaxbytes_, ramaxduration_);
+        }
+
+        return ret;
+    }
+
+    void gdemux::index_set(int index, std::vector<gindexentry>&& entries)
+    {
+        auto& idx = indexes_[index];
+        idx.entries = std::move(entries);
+        idx.bypts.clear();
+        idx.keys.clear();
+        idx.bypts.reserve(idx.entries.size());
+        for (size_t i = 0; i < idx.entries.size(); ++i)
+        {
+            const auto& e = idx.entries[i];
+            auto pts = e.pts != AV_NOPTS_VALUE ? e.pts : e.dts;
+            if (pts == AV_NOPTS_VALUE)
+            {
+                continue;
+            }
+            idx.bypts.push_back(std::make_pair(pts, static_cast<int>(i)));
+            if (e.flags & AV_PKT_FLAG_KEY)
+            {
+                idx.keys.push_back(static_cast<int>(i));
+            }
+        }
+        std::sort(idx.bypts.begin(), idx.bypts.end());
+    }
+
+    void gdemux::normalize_reset()
+    {
+        // 跳转后的时间戳回到容器原来的时间线, 起点不变
+        tsstates_.clear();
+        normoffset_ = 0;
+    }
+
+    void gdemux::normalize(AVPacket* packet)
+    {
+        if (!normalize_ || packet->stream_index < 0 || static_cast<unsigned int>(packet->stream_index) >= fmtctx_->nb_streams)
+        {
+            return;
+        }
+        // AVFMTCTX_NOHEADER的输入读包时才会增加流
+        if (tsstates_.size() < fmtctx_->nb_streams)
+        {
+            tsstates_.resize(fmtctx_->nb_streams);
+        }
+        auto st = fmtctx_->streams[packet->stream_index];
+        auto& state = tsstates_[packet->stream_index];
+        auto dts = packet->dts;
+        auto pts = packet->pts;
+
+        // 去回绕, 与上一个包相差超过半个周期时认为发生了回绕
+        if (st->pts_wrap_bits > 0 && st->pts_wrap_bits < 63)
+        {
+            auto period = static_cast<int64_t>(1) << st->pts_wrap_bits;
+            auto raw = dts != AV_NOPTS_VALUE ? dts : pts;
+            if (raw != AV_NOPTS_VALUE && state.lastdts != AV_NOPTS_VALUE)
+            {
+                if (raw + state.wrap < state.lastdts - period / 2)
+                {
+                    state.wrap += period;
+                }
+                else if (raw + state.wrap > state.lastdts + period / 2)
+                {
+                    state.wrap -= period;
+                }
+            }
+            if (dts != AV_NOPTS_VALUE)
+            {
+                dts += state.wrap;
+            }
+            if (pts != AV_NOPTS_VALUE)
+            {
+                pts += state.wrap;
+                // pts在dts之前先回绕
+                if (dts != AV_NOPTS_VALUE && pts < dts - period / 2)
+                {
+                    pts += period;
+                }
+                else if (dts != AV_NOPTS_VALUE && pts > dts + period / 2)
+                {
+                    pts -= period;
+                }
+            }
+            if (raw != AV_NOPTS_VALUE)
+            {
+                state.lastdts = dts != AV_NOPTS_VALUE ? dts : pts;
+            }
+        }
+
+        // 转换到输出时基, 所有流按同一个起点
+        dts = dts != AV_NOPTS_VALUE ? av_rescale_q(dts, st->time_base, normtb_) : AV_NOPTS_VALUE;
+        pts = pts != AV_NOPTS_VALUE ? av_rescale_q(pts, st->time_base, normtb_) : AV_NOPTS_VALUE;
+        auto duration = packet->duration > 0 ? av_rescale_q(packet->duration, st->time_base, normtb_) : 0;
+        if (normorigin_ == AV_NOPTS_VALUE)
+        {
+            if (fmtctx_->start_time != AV_NOPTS_VALUE)
+            {
+                normorigin_ = av_rescale_q(fmtctx_->start_time, { 1, AV_TIME_BASE }, normtb_);
+            }
+            else if (dts != AV_NOPTS_VALUE || pts != AV_NOPTS_VALUE)
+            {
+                normorigin_ = dts != AV_NOPTS_VALUE ? dts : pts;
+            }
+        }
+        auto offset = normoffset_ - (normorigin_ != AV_NOPTS_VALUE ? normorigin_ : 0);
+        if (dts != AV_NOPTS_VALUE)
+        {
+            dts += offset;
+        }
+        if (pts != AV_NOPTS_VALUE)
+        {
+            pts += offset;
+        }
+
+        // 不连续, 只按音视频流判断, 字幕等稀疏流的间隔本来就可能很长
+        // 修正量对所有流生效, 流之间保持同步
+        auto type = st->codecpar->codec_type;
+        if ((type == AVMEDIA_TYPE_VIDEO || type == AVMEDIA_TYPE_AUDIO) &&
+            dts != AV_NOPTS_VALUE && state.nextdts != AV_NOPTS_VALUE)
+        {
+            auto delta = state.nextdts - dts;
+            if (delta > normthreshold_ || delta < -normthreshold_)
+            {
+                normoffset_ += delta;
+                dts += delta;
+                if (pts != AV_NOPTS_VALUE)
+                {
+                    pts += delta;
+                }
+            }
+        }
+
+        // 缺少dts时按上一个包推算
+        if (dts == AV_NOPTS_VALUE)
+        {
+            dts = state.nextdts != AV_NOPTS_VALUE ? state.nextdts : pts;
+        }
+        // dts严格递增, pts不小于dts
+        if (dts != AV_NOPTS_VALUE && state.outdts != AV_NOPTS_VALUE && dts <= state.outdts)
+        {
+            dts = state.outdts + 1;
+        }
+        if (pts != AV_NOPTS_VALUE && dts != AV_NOPTS_VALUE && pts < dts)
+        {
+            pts = dts;
+        }
+        if (dts != AV_NOPTS_VALUE)
+        {
+            state.outdts = dts;
+            state.nextdts = dts + duration;
+        }
+
+        packet->dts = dts;
+        packet->pts = pts;
+        packet->duration = duration;
+    }
+}//gff
\ No newline at end of file
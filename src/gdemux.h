@@ -14,6 +14,9 @@
 #define __GDEMUX_H__
 
 #include "gavbase.h"
+#include "gutil.h"
+#include "gmmap.h"
+#include "gstreaminfo.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -27,10 +30,109 @@ extern "C"
 }
 #endif
 
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
 #include <vector>
 
 namespace gff
 {
+    // avio缓冲区默认大小
+    const size_t GDEMUX_AVIO_BUFSIZE = 64 * 1024;
+
+    // 自定义输入接口
+    class gdemuxio
+    {
+    public:
+        virtual ~gdemuxio() = default;
+
+        /*
+         * @brief           读取数据
+         * @return          读取的长度, 结束返回AVERROR_EOF, 失败返回错误码
+         * @param buf[out]  接收数据
+         * @param size[in]  最多读取的长度
+        */
+        virtual int read(uint8_t* buf, int size) = 0;
+
+        /*
+         * @brief           跳转到绝对位置
+         * @return          新位置, 失败返回错误码
+         * @param pos[in]   目标位置
+        */
+        virtual int64_t seek(int64_t pos) = 0;
+
+        /*
+         * @brief   获取总长度
+         * @return  总长度, 未知时返回AVERROR(ENOSYS)
+        */
+        virtual int64_t size() = 0;
+
+        /*
+         * @brief   是否支持跳转, 不支持时seek不会被调用
+         * @return  是否支持
+        */
+        virtual bool seekable()
+        {
+            return true;
+        }
+    };
+
+    // 内存输入, 数据在输入关闭前必须有效
+    class gmemio : public gdemuxio
+    {
+    public:
+        /*
+         * @brief           构造
+         * @param data[in]  数据地址
+         * @param size[in]  数据长度
+        */
+        gmemio(const uint8_t* data, int64_t size);
+
+        int read(uint8_t* buf, int size) override;
+        int64_t seek(int64_t pos) override;
+        int64_t size() override;
+
+    private:
+        const uint8_t* data_ = nullptr;
+        int64_t size_ = 0;
+        int64_t pos_ = 0;
+    };
+
+    // 打开方式
+    typedef enum OPENPROFILE
+    {
+        OPEN_DEFAULT,   // 默认探测, 打印格式信息
+        OPEN_FAST,      // 限制探测数据量和时长, 不打印格式信息
+        OPEN_LIVE,      // 实时输入(采集设备, 网络流), 尽量不缓冲:
+                        // fflags nobuffer, avioflags direct, 极小的probesize和analyzeduration, max_delay为0
+                        // 不使用流信息缓存, 不打印格式信息
+                        // flush_packets是封装选项, 输出端需要在gmux::write_header时单独设置
+    } OPENPROFILE;
+
+    // 预读统计
+    typedef struct greadaheadstats
+    {
+        size_t packets;     // 缓冲的包数
+        size_t bytes;       // 缓冲的字节数
+        int64_t durationus; // 缓冲的时长(微秒)
+        double fullness;    // 缓冲占预读上限的比例
+        uint64_t reads;     // 从缓冲读取的包数
+        uint64_t underruns; // 读取时缓冲为空需要等待的次数
+    } greadaheadstats;
+
+    // 按索引跳转的结果, 时间戳为流时基
+    typedef struct gindexseek
+    {
+        int64_t keypts;     // 跳转到的关键帧pts
+        int64_t keydts;     // 关键帧dts
+        int64_t keypos;     // 关键帧字节位置, 未知为-1
+        int64_t targetpts;  // 目标帧pts, 显示时间不晚于请求时间戳的最后一帧
+        int decodes;        // 从关键帧到目标帧(含)按解码顺序需要送入解码器的本流包数
+        int skips;          // 解码输出中排在目标帧之前需要丢弃的帧数
+    } gindexseek;
+
     class gdemux : public gavbase
     {
     public:
@@ -45,16 +147,99 @@ namespace gff
          * @param read_packet[in]   自定义输入回调
          * @param opaque[in]        自定义输入回调的用户参数
          * @param bufsize[in]       avio缓冲区大小
+         * @param seek[in]          自定义输入的跳转回调, 为空时输入不可跳转
         */
         int open(const char* in, const char* fmt = nullptr, const std::vector<std::pair<std::string, std::string>>& dicts = {},
-            int (*read_packet)(void* opaque, uint8_t* buf, int buf_size) = nullptr, void* opaque = nullptr, size_t bufsize = 1024);
+            int (*read_packet)(void* opaque, uint8_t* buf, int buf_size) = nullptr, void* opaque = nullptr, size_t bufsize = GDEMUX_AVIO_BUFSIZE,
+            int64_t(*seek)(void* opaque, int64_t offset, int whence) = nullptr);
+
+        /*
+         * @brief               设置打开方式, 在open之前调用
+         * @return              错误码
+         * @param profile[in]   打开方式
+        */
+        int set_open_profile(OPENPROFILE profile);
+
+        /*
+         * @brief           设置流信息缓存目录, 在open之前调用
+         *                  打开本地文件时按(路径,大小,修改时间)查找缓存, 命中时跳过avformat_find_stream_info
+         * @return          错误码
+         * @param dir[in]   缓存目录, 必须已存在, 为空时不使用缓存
+        */
+        int set_info_cache(const char* dir);
+
+        /*
+         * @brief           设置取消标记, 在open之前调用
+         *                  同一个标记可以设置给多个对象, 一次取消所有对象的阻塞I/O
+         * @return          错误码
+         * @param token[in] 取消标记, 为空时使用自己的标记
+        */
+        int set_cancel_token(const std::shared_ptr<gcanceltoken>& token);
+
+        /*
+         * @brief               设置打开, 读取和跳转时每次阻塞I/O的超时, 超时返回AVERROR_EXIT
+         * @return              错误码
+         * @param timeoutus[in] 超时(微秒), 0为不限制
+        */
+        int set_io_timeout(int64_t timeoutus);
+
+        /*
+         * @brief   取消, 不加锁, 可以在其他线程调用
+         *          正在阻塞的打开和读取在几毫秒内返回AVERROR_EXIT, 之后需要cleanup
+         *          使用共享的取消标记时取消所有使用这个标记的对象
+         * @return  错误码
+        */
+        int cancel();
+
+        /*
+         * @brief                   从自定义输入接口打开
+         * @return                  错误码
+         * @param io[in]            输入接口, 在cleanup之前必须有效
+         * @param in[in]            输入名, 用于按扩展名探测格式, 可以为空
+         * @param fmt[in]           格式
+         * @param dicts[in]         自定义参数键值对
+         * @param bufsize[in]       avio缓冲区大小
+        */
+        int open_io(gdemuxio* io, const char* in = nullptr, const char* fmt = nullptr,
+            const std::vector<std::pair<std::string, std::string>>& dicts = {}, size_t bufsize = GDEMUX_AVIO_BUFSIZE);
+
+        /*
+         * @brief                   内存映射方式打开本地文件, 探测和读取都直接访问映射的内存
+         * @return                  错误码
+         * @param in[in]            文件路径(UTF-8)
+         * @param fmt[in]           格式
+         * @param dicts[in]         自定义参数键值对
+        */
+        int open_mmap(const char* in, const char* fmt = nullptr, const std::vector<std::pair<std::string, std::string>>& dicts = {});
+
+        /*
+         * @brief                   从内存打开, 读取和跳转直接在内存上进行
+         *                          未指定格式时直接在内存上探测, 包数据从内存一次拷贝到AVPacket
+         * @return                  错误码
+         * @param data[in]          数据地址, 在cleanup之前必须有效
+         * @param size[in]          数据长度
+         * @param in[in]            输入名, 用于按扩展名探测格式, 可以为空
+         * @param fmt[in]           格式
+         * @param dicts[in]         自定义参数键值对
+        */
+        int open_memory(const uint8_t* data, int64_t size, const char* in = nullptr, const char* fmt = nullptr,
+            const std::vector<std::pair<std::string, std::string>>& dicts = {});
 
         /*
          * @brief               读取一个AVPacket
          * @return              错误码
          * @param packet[out]   接收数据包
         */
-        int readpacket(std::shared_ptr<AVPacket> packet);
+        int readpacket(const std::shared_ptr<AVPacket>& packet);
+
+        /*
+         * @brief                   批量读取AVPacket, 整批只加锁和检查状态一次
+         * @return                  错误码, 读到至少一个包时返回0, 读取中止的错误在下次调用时返回
+         * @param packets[in]       接收数据包的数组, 元素不能为空
+         * @param count[out]        读到的包数, 依次存放在packets开头
+         * @param maxbytes[in]      读到的字节数达到上限后停止, 0为不限制
+        */
+        int readpackets(const std::vector<std::shared_ptr<AVPacket>>& packets, size_t& count, size_t maxbytes = 0);
 
         /*
          * @brief   清理资源
@@ -79,6 +264,14 @@ namespace gff
         */
         int get_stream_par(unsigned int index, const AVCodecParameters*& par, AVRational& timebase);
 
+        /*
+         * @brief               选择要读取的流, 其他流设置AVDISCARD_ALL, 解封装时不再解析和分配数据
+         *                      预读缓冲中未选择的流的包也会被丢弃
+         * @return              错误码
+         * @param indexes[in]   流索引, 为空时读取所有流
+        */
+        int select_streams(const std::vector<unsigned int>& indexes);
+
         /*
          * @brief                   跳转
          * @return                  错误码
@@ -96,10 +289,194 @@ namespace gff
         */
         int get_duration(int64_t& duration, AVRational timebase = {1,1});
 
+        /*
+         * @brief                   启动预读, 后台线程提前解封装到缓冲, readpacket从缓冲读取
+         * @return                  错误码
+         * @param maxbytes[in]      缓冲字节数上限
+         * @param maxduration[in]   缓冲时长上限(微秒), 0为不限制
+        */
+        int start_readahead(size_t maxbytes = 8 * 1024 * 1024, int64_t maxduration = 0);
+
+        /*
+         * @brief   停止预读, 丢弃缓冲的包
+         * @return  错误码
+        */
+        int stop_readahead();
+
+        /*
+         * @brief               获取预读统计, 不加锁, 可以在其他线程调用
+         *                      没有预读时统计为0
+         * @return              错误码
+         * @param stats[out]    接收统计
+        */
+        int get_readahead_stats(greadaheadstats& stats);
+
+        /*
+         * @brief                   建立流的关键帧索引
+         *                          优先读取索引文件, 其次使用容器中完整的索引, 否则从头扫描一遍所有包
+         *                          新建的索引写入索引文件, 扫描后读取位置回到开头
+         * @return                  错误码
+         * @param index[in]         流索引
+         * @param indexpath[in]     索引文件路径, 为空时设置了流信息缓存目录则放在缓存目录, 否则为输入路径加.gidx
+         *                          不是本地文件时不读写索引文件
+        */
+        int build_index(int index, const char* indexpath = nullptr);
+
+        /*
+         * @brief               获取已建立的索引
+         * @return              错误码
+         * @param index[in]     流索引
+         * @param entries[out]  接收按解码顺序排列的索引项
+        */
+        int get_index(int index, std::vector<gindexentry>& entries);
+
+        /*
+         * @brief                   按索引查找目标帧所需的关键帧, 不跳转, 查找为O(log n)
+         * @return                  错误码, 未建立索引时返回AVERROR(ENOENT)
+         * @param index[in]         流索引
+         * @param timestamp[in]     目标时间戳(流时基)
+         * @param result[out]       接收关键帧和到达目标帧需要解码的帧数
+        */
+        int find_index(int index, int64_t timestamp, gindexseek& result);
+
+        /*
+         * @brief                   按索引跳转到目标帧所需的关键帧, 查找为O(log n)
+         *                          ts, ps等时间戳可能不连续的格式按字节位置跳转, 其他格式按关键帧的dts跳转
+         * @return                  错误码
+         * @param index[in]         已建立索引的流
+         * @param timestamp[in]     目标时间戳(流时基)
+         * @param result[out]       接收关键帧和到达目标帧需要解码的帧数
+        */
+        int seek_index(int index, int64_t timestamp, gindexseek& result);
+
+        /*
+         * @brief                   设置时间戳规整, 开启后readpacket输出的pts/dts/duration为timebase时基
+         *                          所有流按同一个起点从0开始, 处理时间戳回绕(例如MPEG-TS的33位)
+         *                          跳变超过threshold时视为不连续, 所有流一起修正
+         *                          每个流的dts严格递增, pts不小于dts
+         *                          跳转后重新检测回绕和不连续, 起点不变
+         *                          跳转和索引仍使用流时基下的原始时间戳, gseeker需要在关闭时使用
+         * @return                  错误码
+         * @param enable[in]        是否开启
+         * @param timebase[in]      输出时基
+         * @param threshold[in]     不连续的阈值(微秒)
+        */
+        int set_normalize(bool enable, AVRational timebase = { 1, AV_TIME_BASE }, int64_t threshold = 10 * AV_TIME_BASE);
+
+        /*
+         * @brief               获取readpacket的取包延时统计
+         *                      预读时为包从av_read_frame读出后在缓冲中等待的时间
+         *                      直接读取时为av_read_frame的耗时, 实时输入上即等待数据到达的时间
+         * @return              错误码
+         * @param stats[out]    接收统计
+        */
+        int get_arrival_stats(glatencystats& stats);
+
     private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
+        // 读取最多size个包, 调用前需已加锁
+        int read_packets(const std::shared_ptr<AVPacket>* packets, size_t size, size_t maxbytes, size_t& count);
+
+        // 预读, 调用前需已加锁
+        int readahead_start(size_t maxbytes, int64_t maxduration);
+        void readahead_stop(bool drop = true);
+        void readahead_run();
+        bool readahead_full() const;
+
+        // 打开输入, read_packet不为空时使用自定义avio
+        int open_input(const char* in, const char* fmt, const std::vector<std::pair<std::string, std::string>>& dicts,
+            int (*read_packet)(void* opaque, uint8_t* buf, int buf_size), int64_t(*seek)(void* opaque, int64_t offset, int whence),
+            void* opaque, size_t bufsize, bool direct);
+
+        // 自定义输入和当前位置
+        struct ioinput
+        {
+            gdemuxio* io = nullptr;
+            int64_t pos = 0;
+        };
+
+        // 自定义输入的avio回调
+        static int io_read(void* opaque, uint8_t* buf, int buf_size);
+        static int64_t io_seek(void* opaque, int64_t offset, int whence);
+
+        // 流索引, 调用前需已加锁
+        struct streamindex
+        {
+            std::vector<gindexentry> entries;               // 按解码顺序
+            std::vector<std::pair<int64_t, int>> bypts;     // (pts, 解码序号), 按pts排序
+            std::vector<int> keys;                          // 关键帧的解码序号
+        };
+        int index_lookup(int index, int64_t timestamp, gindexseek& result);
+        // 时间戳规整, 调用前需已加锁
+        void normalize(AVPacket* packet);
+        void normalize_reset();
+
+        bool index_from_container(int index, std::vector<gindexentry>& entries);
+        int index_scan(int index, std::vector<gindexentry>& entries);
+        void index_set(int index, std::vector<gindexentry>&& entries);
+
         AVFormatContext* fmtctx_ = nullptr;
         AVInputFormat* infmt_ = nullptr;
         AVDictionary* dict_ = nullptr;
+        AVIOContext* avio_ = nullptr;
+        std::string url_;
+
+        // 打开方式和流信息缓存目录
+        OPENPROFILE profile_ = OPEN_DEFAULT;
+        std::string infocache_;
+
+        // 自定义输入
+        ioinput ioinput_;
+
+        // 内存映射和内存输入
+        gmmap mmap_;
+        std::unique_ptr<gmemio> memio_;
+
+        // 预读缓冲的包, 时间戳(微秒)和读出的时间
+        struct readaheaditem
+        {
+            std::shared_ptr<AVPacket> packet;
+            int64_t dtsus;
+            int64_t arrival;
+        };
+        std::thread rathread_;
+        std::mutex ramutex_;
+        std::condition_variable racv_;
+        std::deque<readaheaditem> raqueue_;
+        size_t rabytes_ = 0;
+        size_t ramaxbytes_ = 0;
+        int64_t ramaxduration_ = 0;
+        bool rastop_ = false;
+        int raret_ = 0;
+        uint64_t rareads_ = 0;
+        uint64_t raunderruns_ = 0;
+        gpacketpool rapool_;
+
+        // 读出到返回的延时
+        glatencyhistogram arrival_;
+
+        // 取消和超时
+        giointerrupt interrupt_;
+
+        // 已建立的索引
+        std::map<int, streamindex> indexes_;
+
+        // 时间戳规整, 每个流的状态
+        struct tsstate
+        {
+            int64_t lastdts = AV_NOPTS_VALUE;   // 上一个包去回绕后的dts(流时基)
+            int64_t wrap = 0;                   // 回绕累计的偏移(流时基)
+            int64_t outdts = AV_NOPTS_VALUE;    // 上一个输出的dts(输出时基)
+            int64_t nextdts = AV_NOPTS_VALUE;   // 预测的下一个输出dts(输出时基)
+        };
+        bool normalize_ = false;
+        AVRational normtb_ = { 1, AV_TIME_BASE };
+        int64_t normthreshold_ = 0;
+        int64_t normorigin_ = AV_NOPTS_VALUE;   // 起点(输出时基)
+        int64_t normoffset_ = 0;                // 不连续累计的修正(输出时基)
+        std::vector<tsstate> tsstates_;
     };
 }//gff
 
@@ -24,6 +24,11 @@ namespace gff
     {
         LOCK();
 
+        return release();
+    }
+
+    int genc::release()
+    {
         avcodec_free_context(&codectx_);
         getstatus() = STOP;
 
@@ -41,7 +46,7 @@ namespace gff
             CHECKFFRET(AVERROR(EINVAL));
         }
 
-        cleanup();
+        release();
         codectx_ = avcodec_alloc_context3(codec);
         if (codectx_ == nullptr)
         {
@@ -77,7 +82,7 @@ namespace gff
             CHECKFFRET(AVERROR(EINVAL));
         }
 
-        cleanup();
+        release();
         codectx_ = avcodec_alloc_context3(codec);
         if (codectx_ == nullptr)
         {
@@ -110,7 +115,7 @@ namespace gff
         return 0;
     }
 
-    int genc::encode_push_frame(std::shared_ptr<AVFrame> frame)
+    int genc::encode_push_frame(const std::shared_ptr<AVFrame>& frame)
     {
         LOCK();
         CHECKNOTSTOP();
@@ -123,7 +128,7 @@ namespace gff
         return avcodec_send_frame(codectx_, frame == nullptr ? nullptr : frame.get());
     }
 
-    int genc::encode_get_packet(std::shared_ptr<AVPacket> packet)
+    int genc::encode_get_packet(const std::shared_ptr<AVPacket>& packet)
     {
         LOCK();
         CHECKNOTSTOP();
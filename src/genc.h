@@ -78,16 +78,19 @@ namespace gff
          * @return          错误码
          * @param frame[in] 输入帧
         */
-        int encode_push_frame(std::shared_ptr<AVFrame> frame);
+        int encode_push_frame(const std::shared_ptr<AVFrame>& frame);
 
         /*
          * @brief               获取编码
          * @return              错误码
          * @param frame[out]    输出帧
         */
-        int encode_get_packet(std::shared_ptr<AVPacket> packet);
+        int encode_get_packet(const std::shared_ptr<AVPacket>& packet);
 
     private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
         AVCodecContext* codectx_ = nullptr;
     };
 }//gff
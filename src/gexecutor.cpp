@@ -0,0 +1,195 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gexecutor.cpp
+*  简要描述:    任务窃取线程池
+*
+*  作者:  gongluck
+*  说明:
+*
+*******************************************************************/
+
+#include "gexecutor.h"
+#include "gutil.h"
+
+namespace gff
+{
+    // 当前线程所属的线程池和工作线程序号
+    static thread_local gexecutor* tls_executor = nullptr;
+    static thread_local size_t tls_index = 0;
+
+    gexecutor::~gexecutor()
+    {
+        cleanup();
+    }
+
+    int gexecutor::cleanup()
+    {
+        LOCK();
+
+        return release();
+    }
+
+    int gexecutor::release()
+    {
+        // 先停止接受任务, 工作线程执行完队列中的任务后退出
+        // 不能在等待工作线程时持有独占锁, 任务内的submit会阻塞
+        {
+            std::unique_lock<std::shared_timed_mutex> wlck(workersmutex_);
+            accepting_ = false;
+        }
+        running_ = false;
+        {
+            std::lock_guard<std::mutex> lck(idlemutex_);
+            idlecv_.notify_all();
+        }
+        for (auto& w : workers_)
+        {
+            if (w->thread.joinable())
+            {
+                w->thread.join();
+            }
+        }
+        {
+            std::unique_lock<std::shared_timed_mutex> wlck(workersmutex_);
+            workers_.clear();
+        }
+        pending_ = 0;
+        getstatus() = STOP;
+
+        return 0;
+    }
+
+    int gexecutor::create(size_t threads/* = 0*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        if (threads == 0)
+        {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+
+        std::unique_lock<std::shared_timed_mutex> wlck(workersmutex_);
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers_.emplace_back(new worker);
+        }
+        running_ = true;
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers_[i]->thread = std::thread(&gexecutor::run, this, i);
+        }
+        accepting_ = true;
+
+        getstatus() = WORKING;
+
+        return 0;
+    }
+
+    int gexecutor::submit(std::function<void()> task)
+    {
+        // 任务内也会调用, 不加对象锁, 共享锁保证清理时workers_有效
+        std::shared_lock<std::shared_timed_mutex> wlck(workersmutex_);
+        if (!accepting_ || task == nullptr)
+        {
+            return AVERROR(EINVAL);
+        }
+
+        // 先计数再入队, 取任务时计数不会减到负数
+        ++pending_;
+        auto index = tls_executor == this ? tls_index : next_++ % workers_.size();
+        {
+            std::lock_guard<std::mutex> lck(workers_[index]->mutex);
+            workers_[index]->tasks.push_back(std::move(task));
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lck(idlemutex_);
+            idlecv_.notify_one();
+        }
+
+        return 0;
+    }
+
+    int gexecutor::get_threads(size_t& threads)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        threads = workers_.size();
+
+        return 0;
+    }
+
+    void gexecutor::run(size_t index)
+    {
+        tls_executor = this;
+        tls_index = index;
+
+        std::function<void()> task;
+        for (;;)
+        {
+            if (take(index, task))
+            {
+                task();
+                task = nullptr;
+                continue;
+            }
+            // 停止后排空所有队列才退出, 已提交的任务不会丢失
+            if (!running_)
+            {
+                break;
+            }
+
+            std::unique_lock<std::mutex> lck(idlemutex_);
+            sleepers_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            idlecv_.wait(lck, [this]() { return !running_ || pending_ > 0; });
+            sleepers_.fetch_sub(1);
+        }
+
+        tls_executor = nullptr;
+    }
+
+    bool gexecutor::take(size_t index, std::function<void()>& task)
+    {
+        // 本线程队列按提交顺序执行
+        {
+            auto& w = *workers_[index];
+            std::lock_guard<std::mutex> lck(w.mutex);
+            if (!w.tasks.empty())
+            {
+                task = std::move(w.tasks.front());
+                w.tasks.pop_front();
+                --pending_;
+                return true;
+            }
+        }
+
+        // 从其他线程队列尾部窃取
+        for (size_t i = 1; i < workers_.size(); ++i)
+        {
+            auto& w = *workers_[(index + i) % workers_.size()];
+            std::lock_guard<std::mutex> lck(w.mutex);
+            if (!w.tasks.empty())
+            {
+                task = std::move(w.tasks.back());
+                w.tasks.pop_back();
+                --pending_;
+                return true;
+            }
+        }
+
+        return false;
+    }
+}//gff
@@ -0,0 +1,94 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gexecutor.h
+*  简要描述:    任务窃取线程池
+*
+*  作者:  gongluck
+*  说明:    每个工作线程一个任务队列, 自己的队列为空时从其他线程的队列尾部窃取
+*           工作线程内提交的任务进入本线程队列尾部, 外部提交的任务轮流分配
+*
+*******************************************************************/
+
+#ifndef __GEXECUTOR_H__
+#define __GEXECUTOR_H__
+
+#include "gavbase.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+namespace gff
+{
+    class gexecutor : public gavbase
+    {
+    public:
+        ~gexecutor();
+
+        /*
+         * @brief   停止接受新任务, 执行完已提交的任务后停止工作线程
+         *          之后(包括任务内)调用submit返回错误
+         * @return  错误码
+        */
+        int cleanup() override;
+
+        /*
+         * @brief               创建工作线程
+         * @return              错误码
+         * @param threads[in]   线程数, 0为CPU核心数
+        */
+        int create(size_t threads = 0);
+
+        /*
+         * @brief           提交任务, 可以在任务内调用
+         * @return          错误码, 未创建或正在清理时返回AVERROR(EINVAL)
+         * @param task[in]  任务
+        */
+        int submit(std::function<void()> task);
+
+        /*
+         * @brief               获取工作线程数
+         * @return              错误码
+         * @param threads[out]  接收线程数
+        */
+        int get_threads(size_t& threads);
+
+    private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
+        struct worker
+        {
+            std::thread thread;
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        // 工作线程
+        void run(size_t index);
+
+        // 取本线程任务或窃取其他线程任务
+        bool take(size_t index, std::function<void()>& task);
+
+        // submit持有共享锁访问workers_, 修改workers_和accepting_需要独占锁
+        std::shared_timed_mutex workersmutex_;
+        std::vector<std::unique_ptr<worker>> workers_;
+        bool accepting_ = false;
+        std::atomic<bool> running_{ false };
+        std::atomic<size_t> pending_{ 0 };
+        std::atomic<size_t> next_{ 0 };
+
+        // 空闲等待
+        std::mutex idlemutex_;
+        std::condition_variable idlecv_;
+        std::atomic<int> sleepers_{ 0 };
+    };
+}//gff
+
+#endif//__GEXECUTOR_H__
@@ -0,0 +1,174 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gmmap.cpp
+*  简要描述:    文件内存映射
+*
+*  作者:  gongluck
+*  说明:
+*
+*******************************************************************/
+
+#include "gmmap.h"
+#include "gutil.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gff
+{
+    gmmap::~gmmap()
+    {
+        cleanup();
+    }
+
+    int gmmap::cleanup()
+    {
+        LOCK();
+
+        return release();
+    }
+
+    int gmmap::release()
+    {
+#ifdef _WIN32
+        if (data_ != nullptr)
+        {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_ != nullptr)
+        {
+            CloseHandle(mapping_);
+            mapping_ = nullptr;
+        }
+        if (file_ != nullptr)
+        {
+            CloseHandle(file_);
+            file_ = nullptr;
+        }
+#else
+        if (data_ != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(data_), static_cast<size_t>(size_));
+        }
+        if (fd_ >= 0)
+        {
+            close(fd_);
+            fd_ = -1;
+        }
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        getstatus() = STOP;
+
+        return 0;
+    }
+
+    int gmmap::open(const char* path)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        if (path == nullptr)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+
+#ifdef _WIN32
+        auto len = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+        if (len <= 0)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+        std::vector<wchar_t> wpath(len);
+        MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath.data(), len);
+
+        auto file = CreateFileW(wpath.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            CHECKFFRET(AVERROR(ENOENT));
+        }
+        file_ = file;
+
+        LARGE_INTEGER size = { 0 };
+        if (!GetFileSizeEx(file, &size))
+        {
+            release();
+            CHECKFFRET(AVERROR(EIO));
+        }
+        size_ = size.QuadPart;
+
+        // 空文件不能映射
+        if (size_ > 0)
+        {
+            mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_ == nullptr)
+            {
+                release();
+                CHECKFFRET(AVERROR(EIO));
+            }
+            data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+            if (data_ == nullptr)
+            {
+                release();
+                CHECKFFRET(AVERROR(ENOMEM));
+            }
+        }
+#else
+        fd_ = ::open(path, O_RDONLY);
+        if (fd_ < 0)
+        {
+            CHECKFFRET(AVERROR(errno));
+        }
+
+        struct stat st;
+        if (fstat(fd_, &st) != 0)
+        {
+            int ret = AVERROR(errno);
+            release();
+            CHECKFFRET(ret);
+        }
+        size_ = st.st_size;
+
+        // 空文件不能映射
+        if (size_ > 0)
+        {
+            auto data = mmap(nullptr, static_cast<size_t>(size_), PROT_READ, MAP_SHARED, fd_, 0);
+            if (data == MAP_FAILED)
+            {
+                int ret = AVERROR(errno);
+                size_ = 0;
+                release();
+                CHECKFFRET(ret);
+            }
+            data_ = static_cast<const uint8_t*>(data);
+            // 解封装基本是顺序读
+            madvise(data, static_cast<size_t>(size_), MADV_SEQUENTIAL);
+        }
+#endif
+
+        getstatus() = WORKING;
+
+        return 0;
+    }
+
+    int gmmap::get_data(const uint8_t*& data, int64_t& size)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        data = data_;
+        size = size_;
+
+        return 0;
+    }
+}//gff
\ No newline at end of file
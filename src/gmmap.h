@@ -0,0 +1,63 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gmmap.h
+*  简要描述:    文件内存映射
+*
+*  作者:  gongluck
+*  说明:    只读映射整个文件
+*
+*******************************************************************/
+
+#ifndef __GMMAP_H__
+#define __GMMAP_H__
+
+#include "gavbase.h"
+
+#include <cstdint>
+
+namespace gff
+{
+    class gmmap : public gavbase
+    {
+    public:
+        ~gmmap();
+
+        /*
+         * @brief   解除映射
+         * @return  错误码
+        */
+        int cleanup() override;
+
+        /*
+         * @brief           只读映射文件
+         * @return          错误码
+         * @param path[in]  文件路径(UTF-8)
+        */
+        int open(const char* path);
+
+        /*
+         * @brief           获取映射的数据, 在cleanup之前一直有效
+         * @return          错误码
+         * @param data[out] 接收数据地址, 空文件为nullptr
+         * @param size[out] 接收数据长度
+        */
+        int get_data(const uint8_t*& data, int64_t& size);
+
+    private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
+        const uint8_t* data_ = nullptr;
+        int64_t size_ = 0;
+#ifdef _WIN32
+        void* file_ = nullptr;
+        void* mapping_ = nullptr;
+#else
+        int fd_ = -1;
+#endif
+    };
+}//gff
+
+#endif//__GMMAP_H__
@@ -24,18 +24,31 @@ namespace gff
     {
         LOCK();
 
+        return release();
+    }
+
+    int gmux::release()
+    {
+        int ret = 0;
         if (fmt_ != nullptr)
         {
-            int ret = av_write_trailer(fmt_);
-            CHECKFFRET(ret);
-            ret = avio_closep(&fmt_->pb);
-            CHECKFFRET(ret);
+            // 取消或超时后写尾会失败, 仍然释放资源
+            interrupt_.begin();
+            ret = av_write_trailer(fmt_);
+            auto closeret = avio_closep(&fmt_->pb);
+            interrupt_.end();
+            if (ret >= 0)
+            {
+                ret = closeret;
+            }
             av_dump_format(fmt_, -1, fmt_->url, 1);
             avformat_free_context(fmt_);
             fmt_ = nullptr;
         }
+        interrupt_.reset();
 
         getstatus() = STOP;
+        CHECKFFRET(ret);
 
         return 0;
     }
@@ -45,15 +58,42 @@ namespace gff
         LOCK();
         CHECKSTOP();
 
-        cleanup();
+        release();
         int ret = avformat_alloc_output_context2(&fmt_, nullptr, nullptr, out);
         CHECKFFRET(ret);
+        fmt_->interrupt_callback = interrupt_.get_callback();
 
         getstatus() = WORKING;
 
         return 0;
     }
 
+    int gmux::set_cancel_token(const std::shared_ptr<gcanceltoken>& token)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        interrupt_.set_token(token);
+
+        return 0;
+    }
+
+    int gmux::set_io_timeout(int64_t timeoutus)
+    {
+        // 只修改原子变量, 不加对象锁
+        interrupt_.set_timeout(timeoutus);
+
+        return 0;
+    }
+
+    int gmux::cancel()
+    {
+        // 阻塞的调用持有对象锁, 不能加锁
+        interrupt_.cancel();
+
+        return 0;
+    }
+
     int gmux::create_stream(const AVCodecContext* codectx, int& index)
     {
         LOCK();
@@ -79,7 +119,7 @@ namespace gff
         return 0;
     }
 
-    int gmux::write_header()
+    int gmux::write_header(const std::vector<std::pair<std::string, std::string>>& dicts/* = {}*/)
     {
         LOCK();
         CHECKNOTSTOP();
@@ -89,12 +129,31 @@ namespace gff
             CHECKFFRET(AVERROR(EINVAL));
         }
 
-        int ret = avio_open2(&fmt_->pb, fmt_->url, AVIO_FLAG_WRITE, nullptr, nullptr);
+        interrupt_.begin();
+        int ret = avio_open2(&fmt_->pb, fmt_->url, AVIO_FLAG_WRITE, &fmt_->interrupt_callback, nullptr);
+        interrupt_.end();
         CHECKFFRET(ret);
 
         av_dump_format(fmt_, -1, fmt_->url, 1);
 
-        ret = avformat_write_header(fmt_, nullptr);
+        AVDictionary* dict = nullptr;
+        for (const auto& p : dicts)
+        {
+            if (p.first.size() > 0 && p.second.size() > 0)
+            {
+                ret = av_dict_set(&dict, p.first.c_str(), p.second.c_str(), 0);
+                if (ret < 0)
+                {
+                    av_dict_free(&dict);
+                    CHECKFFRET(ret);
+                }
+            }
+        }
+        interrupt_.begin();
+        ret = avformat_write_header(fmt_, &dict);
+        interrupt_.end();
+        // 封装不认识的选项留在dict中
+        av_dict_free(&dict);
         CHECKFFRET(ret);
        
         return 0;
@@ -115,7 +174,7 @@ namespace gff
         return 0;
     }
 
-    int gmux::write_packet(std::shared_ptr<AVPacket> packet)
+    int gmux::write_packet(const std::shared_ptr<AVPacket>& packet)
     {
         LOCK();
         CHECKNOTSTOP();
@@ -125,6 +184,10 @@ namespace gff
             CHECKFFRET(AVERROR(EINVAL));
         }
 
-        return av_interleaved_write_frame(fmt_, packet.get());
+        interrupt_.begin();
+        int ret = av_interleaved_write_frame(fmt_, packet.get());
+        interrupt_.end();
+
+        return ret;
     }
 }//gff
\ No newline at end of file
@@ -14,6 +14,7 @@
 #define __GMUX_H__
 
 #include "gavbase.h"
+#include "gutil.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -46,6 +47,27 @@ namespace gff
         */
         int create_output(const char* out);
 
+        /*
+         * @brief           设置取消标记, 在create_output之前调用
+         * @return          错误码
+         * @param token[in] 取消标记, 为空时使用自己的标记
+        */
+        int set_cancel_token(const std::shared_ptr<gcanceltoken>& token);
+
+        /*
+         * @brief               设置打开输出, 写入时每次阻塞I/O的超时, 超时返回AVERROR_EXIT
+         * @return              错误码
+         * @param timeoutus[in] 超时(微秒), 0为不限制
+        */
+        int set_io_timeout(int64_t timeoutus);
+
+        /*
+         * @brief   取消, 不加锁, 可以在其他线程调用
+         *          正在阻塞的写入在几毫秒内返回AVERROR_EXIT, 之后需要cleanup, 输出可能不完整
+         * @return  错误码
+        */
+        int cancel();
+
         /*
          * @brief               创建输出
          * @return              错误码
@@ -57,8 +79,9 @@ namespace gff
         /*
          * @brief               写头
          * @return              错误码
+         * @param dicts[in]     封装选项键值对, 例如实时输出的{"flush_packets", "1"}
         */
-        int write_header();
+        int write_header(const std::vector<std::pair<std::string, std::string>>& dicts = {});
 
         /*
          * @brief               获取时基
@@ -73,10 +96,16 @@ namespace gff
          * @return              错误码
          * @param packet[in]    帧
         */
-        int write_packet(std::shared_ptr<AVPacket> packet);
+        int write_packet(const std::shared_ptr<AVPacket>& packet);
 
     private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
         AVFormatContext* fmt_ = nullptr;
+
+        // 取消和超时
+        giointerrupt interrupt_;
     };
 }//gff
 
@@ -0,0 +1,366 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gpardec.cpp
+*  简要描述:    按GOP并行解码
+*
+*  作者:  gongluck
+*  说明:
+*
+*******************************************************************/
+
+#include "gpardec.h"
+
+namespace gff
+{
+    gpardec::~gpardec()
+    {
+        cleanup();
+    }
+
+    int gpardec::cleanup()
+    {
+        LOCK();
+
+        return release();
+    }
+
+    int gpardec::release()
+    {
+        // 已提交的任务执行完后才能释放解码器, 未开始的任务跳过解码
+        abort_ = true;
+        executor_.cleanup();
+        abort_ = false;
+
+        demux_ = nullptr;
+        index_ = -1;
+        maxgops_ = 0;
+        keys_.clear();
+        eof_ = false;
+        building_.reset();
+        leading_.reset();
+        jobs_.clear();
+        freedecs_.clear();
+        decs_.clear();
+        getstatus() = STOP;
+
+        return 0;
+    }
+
+    int gpardec::open(gdemux* demux, int index, size_t workers/* = 0*/, size_t maxgops/* = 0*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        if (demux == nullptr || index < 0)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+        const AVCodecParameters* par = nullptr;
+        AVRational timebase;
+        int ret = demux->get_stream_par(index, par, timebase);
+        CHECKFFRET(ret);
+
+        // 分组使用索引中的关键帧
+        std::vector<gindexentry> entries;
+        if (demux->get_index(index, entries) < 0)
+        {
+            ret = demux->build_index(index);
+            CHECKFFRET(ret);
+            ret = demux->get_index(index, entries);
+            CHECKFFRET(ret);
+        }
+        for (const auto& e : entries)
+        {
+            if (e.flags & AV_PKT_FLAG_KEY)
+            {
+                keys_.insert(e.dts != AV_NOPTS_VALUE ? e.dts : e.pts);
+            }
+        }
+
+        // 建立索引时可能扫描过整个文件, 统一从头开始读取
+        int64_t start = 0;
+        if (!entries.empty())
+        {
+            start = entries.front().dts != AV_NOPTS_VALUE ? entries.front().dts : entries.front().pts;
+        }
+        ret = demux->seek_frame(index, start, false);
+        CHECKFFRET(ret);
+
+        ret = executor_.create(workers);
+        CHECKFFRET(ret);
+        ret = executor_.get_threads(workers);
+        CHECKFFRET(ret);
+
+        // 每个线程一个单线程解码器, 并行由GOP提供
+        for (size_t i = 0; i < workers; ++i)
+        {
+            std::unique_ptr<gdec> dec(new gdec);
+            ret = dec->set_threads(DECTHREAD_AUTO, 1);
+            CHECKFFRET(ret);
+            ret = dec->copy_param(par);
+            CHECKFFRET(ret);
+            freedecs_.push_back(dec.get());
+            decs_.push_back(std::move(dec));
+        }
+
+        demux_ = demux;
+        index_ = index;
+        maxgops_ = maxgops > 0 ? maxgops : workers * 2;
+        stats_ = gpardecstats();
+
+        getstatus() = WORKING;
+
+        return 0;
+    }
+
+    int gpardec::decode(const std::shared_ptr<AVFrame>& frame)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        if (frame == nullptr)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+
+        for (;;)
+        {
+            std::unique_lock<std::mutex> lck(jobmutex_);
+            if (!jobs_.empty() && jobs_.front()->done)
+            {
+                auto job = jobs_.front();
+                if (job->errors > 0)
+                {
+                    stats_.errors += job->errors;
+                    job->errors = 0;
+                }
+                if (job->ret < 0)
+                {
+                    // 只报告一次, 之后继续输出后面的GOP
+                    jobs_.pop_front();
+                    CHECKFFRET(job->ret);
+                }
+                if (job->next >= job->frames.size())
+                {
+                    jobs_.pop_front();
+                    continue;
+                }
+                // 输出后释放, 减少缓存的帧
+                auto out = std::move(job->frames[job->next++]);
+                lck.unlock();
+                av_frame_unref(frame.get());
+                av_frame_move_ref(frame.get(), out.get());
+                ++stats_.frames;
+                return 0;
+            }
+
+            // 提交的GOP未达到上限时继续读取, 否则等待最早的GOP解码完成
+            if (!eof_ && jobs_.size() < maxgops_)
+            {
+                lck.unlock();
+                int ret = read_packet();
+                if (ret == AVERROR_EOF)
+                {
+                    eof_ = true;
+                    continue;
+                }
+                CHECKFFRET(ret);
+                continue;
+            }
+            if (jobs_.empty())
+            {
+                return AVERROR_EOF;
+            }
+            jobcv_.wait(lck, [this]() { return jobs_.front()->done; });
+        }
+    }
+
+    int gpardec::get_stats(gpardecstats& stats)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        stats = stats_;
+
+        return 0;
+    }
+
+    int gpardec::read_packet()
+    {
+        auto packet = GetPacket();
+        int ret = demux_->readpacket(packet);
+        if (ret == AVERROR(EAGAIN))
+        {
+            return 0;
+        }
+        if (ret == AVERROR_EOF)
+        {
+            // 最后一个GOP不限制结束时间
+            if (leading_ != nullptr)
+            {
+                ret = submit(leading_);
+                CHECKFFRET(ret);
+                leading_.reset();
+            }
+            if (building_ != nullptr)
+            {
+                ret = submit(building_);
+                CHECKFFRET(ret);
+                building_.reset();
+            }
+            return AVERROR_EOF;
+        }
+        CHECKFFRET(ret);
+        if (packet->stream_index != index_)
+        {
+            return 0;
+        }
+        ++stats_.packets;
+
+        auto ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+        auto pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        if (leading_ != nullptr)
+        {
+            if (pts != AV_NOPTS_VALUE && pts < leading_->maxpts && keys_.find(ts) == keys_.end())
+            {
+                // 开放GOP开头显示在关键帧之前的帧, 上一个GOP也要解码
+                auto copy = GetPacket();
+                ret = av_packet_ref(copy.get(), packet.get());
+                CHECKFFRET(ret);
+                leading_->packets.push_back(std::move(copy));
+                ++leading_->tail;
+                ++stats_.redecodes;
+            }
+            else
+            {
+                // 只追加了关键帧时是封闭GOP, 不需要重复解码
+                if (leading_->tail == 1)
+                {
+                    leading_->packets.pop_back();
+                    leading_->tail = 0;
+                    --stats_.redecodes;
+                }
+                ret = submit(leading_);
+                CHECKFFRET(ret);
+                leading_.reset();
+            }
+        }
+
+        if (building_ != nullptr && !building_->packets.empty() &&
+            ts != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE && keys_.find(ts) != keys_.end())
+        {
+            // 新的GOP, 上一个GOP输出到这个关键帧之前, 并追加关键帧等待判断是否开放GOP
+            if (leading_ != nullptr)
+            {
+                ret = submit(leading_);
+                CHECKFFRET(ret);
+            }
+            leading_ = std::move(building_);
+            leading_->maxpts = pts;
+            auto copy = GetPacket();
+            ret = av_packet_ref(copy.get(), packet.get());
+            CHECKFFRET(ret);
+            leading_->packets.push_back(std::move(copy));
+            leading_->tail = 1;
+            ++stats_.redecodes;
+
+            building_ = std::make_shared<gopjob>();
+            building_->minpts = pts;
+        }
+        if (building_ == nullptr)
+        {
+            building_ = std::make_shared<gopjob>();
+        }
+        building_->packets.push_back(std::move(packet));
+
+        return 0;
+    }
+
+    int gpardec::submit(const std::shared_ptr<gopjob>& job)
+    {
+        // 提交失败时标记完成并带上错误, decode不会一直等待
+        std::lock_guard<std::mutex> lck(jobmutex_);
+        jobs_.push_back(job);
+        int ret = executor_.submit(std::bind(&gpardec::run, this, job));
+        if (ret < 0)
+        {
+            job->packets.clear();
+            job->ret = ret;
+            job->done = true;
+            jobcv_.notify_all();
+            CHECKFFRET(ret);
+        }
+        ++stats_.gops;
+
+        return 0;
+    }
+
+    void gpardec::run(const std::shared_ptr<gopjob>& job)
+    {
+        gdec* dec = nullptr;
+        {
+            std::lock_guard<std::mutex> lck(jobmutex_);
+            // 同时执行的任务数不超过线程数, 一定有空闲的解码器
+            dec = freedecs_.back();
+            freedecs_.pop_back();
+        }
+
+        uint64_t errors = 0;
+        std::vector<std::shared_ptr<AVFrame>> frames;
+        if (!abort_)
+        {
+            auto onframe = [&frames](const std::shared_ptr<AVFrame>& frame) {
+                frames.push_back(frame);
+                return 0;
+            };
+            // 与单个解码器相同, 出错的包跳过, 继续解码之后的包
+            for (const auto& packet : job->packets)
+            {
+                if (dec->decode_all(packet, onframe) < 0)
+                {
+                    ++errors;
+                }
+            }
+            // 排空解码器
+            int ret = dec->decode_all(nullptr, onframe);
+            if (ret < 0 && ret != AVERROR_EOF)
+            {
+                ++errors;
+            }
+            job->packets.clear();
+            dec->flush();
+        }
+
+        // 解码输出已是显示顺序, 只保留本GOP显示范围内的帧
+        std::vector<std::shared_ptr<AVFrame>> out;
+        out.reserve(frames.size());
+        for (auto& frame : frames)
+        {
+            auto pts = frame_pts(frame);
+            if (pts != AV_NOPTS_VALUE &&
+                ((job->minpts != AV_NOPTS_VALUE && pts < job->minpts) || (job->maxpts != AV_NOPTS_VALUE && pts >= job->maxpts)))
+            {
+                continue;
+            }
+            out.push_back(std::move(frame));
+        }
+
+        {
+            std::lock_guard<std::mutex> lck(jobmutex_);
+            job->frames = std::move(out);
+            job->errors = errors;
+            job->done = true;
+            freedecs_.push_back(dec);
+            jobcv_.notify_all();
+        }
+    }
+
+    int64_t gpardec::frame_pts(const std::shared_ptr<AVFrame>& frame)
+    {
+        return frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+    }
+}//gff
\ No newline at end of file
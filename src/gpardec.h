@@ -0,0 +1,137 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gpardec.h
+*  简要描述:    按GOP并行解码
+*
+*  作者:  gongluck
+*  说明:    按解封装索引中的关键帧把包分成GOP, 每个GOP在线程池上用单独的单线程解码器解码
+*           按显示顺序输出, 适合离线分析时尽快解码整个文件
+*           开放GOP中关键帧之后pts更早的帧属于上一个GOP, 上一个GOP会多解码这个关键帧和这些帧
+*           使用帧内刷新(没有关键帧)的流只能分成一个GOP, 没有加速
+*
+*******************************************************************/
+
+#ifndef __GPARDEC_H__
+#define __GPARDEC_H__
+
+#include "gavbase.h"
+#include "gutil.h"
+#include "gexecutor.h"
+#include "gdemux.h"
+#include "gdec.h"
+
+#include <condition_variable>
+#include <deque>
+#include <set>
+
+namespace gff
+{
+    // 并行解码统计
+    typedef struct gpardecstats
+    {
+        uint64_t gops;      // 提交的GOP数
+        uint64_t packets;   // 读取的本流包数
+        uint64_t redecodes; // 为开放GOP重复解码的包数
+        uint64_t frames;    // 输出的帧数
+        uint64_t errors;    // 解码出错被跳过的包数
+    } gpardecstats;
+
+    class gpardec : public gavbase
+    {
+    public:
+        ~gpardec();
+
+        /*
+         * @brief   等待正在解码的GOP结束并清理资源
+         * @return  错误码
+        */
+        int cleanup() override;
+
+        /*
+         * @brief                   设置输入
+         * @return                  错误码
+         * @param demux[in]         已打开的解封装, 没有索引时建立索引(gdemux::build_index), 之后跳转到开头读取
+         * @param index[in]         视频流索引, 其他流的包被丢弃
+         * @param workers[in]       解码线程数, 0为CPU核心数
+         * @param maxgops[in]       同时解码和等待输出的GOP数上限, 0为workers的2倍, 每个GOP的帧都缓存在内存中
+        */
+        int open(gdemux* demux, int index, size_t workers = 0, size_t maxgops = 0);
+
+        /*
+         * @brief               按显示顺序获取下一帧
+         * @return              错误码, 所有帧输出后返回AVERROR_EOF
+         *                      出错的包被跳过并计入统计, GOP提交失败时返回一次错误后继续输出之后的GOP
+         * @param frame[out]    接收帧(引用)
+        */
+        int decode(const std::shared_ptr<AVFrame>& frame);
+
+        /*
+         * @brief               获取统计
+         * @return              错误码
+         * @param stats[out]    接收统计
+        */
+        int get_stats(gpardecstats& stats);
+
+    private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
+        // 一个GOP的解码任务
+        struct gopjob
+        {
+            std::vector<std::shared_ptr<AVPacket>> packets;
+            // 输出pts在[minpts, maxpts)内的帧, AV_NOPTS_VALUE为不限制
+            int64_t minpts = AV_NOPTS_VALUE;
+            int64_t maxpts = AV_NOPTS_VALUE;
+            // 为开放GOP追加的下一个GOP开头的包数
+            size_t tail = 0;
+            std::vector<std::shared_ptr<AVFrame>> frames;
+            size_t next = 0;
+            // 提交失败的错误码
+            int ret = 0;
+            // 解码出错的包数
+            uint64_t errors = 0;
+            bool done = false;
+        };
+
+        // 读取一个包并按关键帧分组, 输入结束返回AVERROR_EOF
+        int read_packet();
+
+        // 提交GOP
+        int submit(const std::shared_ptr<gopjob>& job);
+
+        // 线程池上解码一个GOP
+        void run(const std::shared_ptr<gopjob>& job);
+
+        // 帧的显示时间
+        static int64_t frame_pts(const std::shared_ptr<AVFrame>& frame);
+
+        gdemux* demux_ = nullptr;
+        int index_ = -1;
+        size_t maxgops_ = 0;
+        // 索引中关键帧的dts(没有dts时为pts)
+        std::set<int64_t> keys_;
+        bool eof_ = false;
+
+        // 正在收集的GOP, 等待追加开放GOP开头的上一个GOP
+        std::shared_ptr<gopjob> building_;
+        std::shared_ptr<gopjob> leading_;
+
+        // 已提交的GOP, 按解码顺序输出
+        std::mutex jobmutex_;
+        std::condition_variable jobcv_;
+        std::deque<std::shared_ptr<gopjob>> jobs_;
+        std::atomic<bool> abort_{ false };
+
+        // 空闲的解码器
+        std::vector<std::unique_ptr<gdec>> decs_;
+        std::vector<gdec*> freedecs_;
+
+        gexecutor executor_;
+        gpardecstats stats_ = { 0 };
+    };
+}//gff
+
+#endif//__GPARDEC_H__
@@ -0,0 +1,815 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gpipeline.cpp
+*  简要描述:    转码流水线
+*
+*  作者:  gongluck
+*  说明:
+*
+*******************************************************************/
+
+#include "gpipeline.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <libavutil/time.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace gff
+{
+    // executor模式下每个任务最多执行的步数, 用完后重新排队保证各流水线公平
+    static const int PIPELINE_QUANTUM = 16;
+
+    // 等待对应的读取时间最多个数, 丢帧时旧的记录会被淘汰
+    static const size_t PIPELINE_LATENCY_PENDING = 1024;
+
+    // 把暂存数据推入队列, 队列满(非阻塞)或已关闭(阻塞)时返回false
+    template<typename QUEUE, typename T>
+    static bool push_pending(QUEUE& queue, std::deque<T>& pending, bool block, uint64_t& pushed)
+    {
+        while (!pending.empty())
+        {
+            if (!(block ? queue.push(std::move(pending.front())) : queue.try_push(std::move(pending.front()))))
+            {
+                return false;
+            }
+            pending.pop_front();
+            ++pushed;
+        }
+        return true;
+    }
+
+    // 从队列取数据
+    template<typename QUEUE, typename T>
+    static bool pop_input(QUEUE& queue, T& item, bool block, uint64_t& popped)
+    {
+        if (block ? queue.pop(item) : queue.try_pop(item))
+        {
+            ++popped;
+            return true;
+        }
+        return false;
+    }
+
+    gpipeline::~gpipeline()
+    {
+        cleanup();
+    }
+
+    int gpipeline::cleanup()
+    {
+        LOCK();
+
+        return release();
+    }
+
+    int gpipeline::release()
+    {
+        abort();
+
+        demux_ = nullptr;
+        dec_ = nullptr;
+        sws_ = nullptr;
+        enc_ = nullptr;
+        mux_ = nullptr;
+        index_ = -1;
+        oindex_ = -1;
+        packetq_.reset();
+        frameq_.reset();
+        scaledq_.reset();
+        opacketq_.reset();
+        demuxout_.clear();
+        decout_.clear();
+        scaleout_.clear();
+        encout_.clear();
+        autosws_.cleanup();
+        autoswscreated_ = false;
+        getstatus() = STOP;
+
+        return 0;
+    }
+
+    int gpipeline::set_stages(gdemux* demux, int index, gdec* dec, gsws* sws, genc* enc, gmux* mux, int oindex, size_t queuesize/* = 64*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        if (demux == nullptr || dec == nullptr || enc == nullptr || mux == nullptr || queuesize == 0)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+
+        const AVCodecParameters* par = nullptr;
+        int ret = demux->get_stream_par(index, par, intb_);
+        CHECKFFRET(ret);
+        // 输入时间戳由解封装规整为从0开始且递增, 时基不变
+        ret = demux->set_normalize(true, intb_);
+        CHECKFFRET(ret);
+
+        const AVCodecContext* codectx = nullptr;
+        ret = enc->get_codectx(codectx);
+        CHECKFFRET(ret);
+        enctb_ = codectx->time_base;
+        encw_ = codectx->width;
+        ench_ = codectx->height;
+        encfmt_ = codectx->pix_fmt;
+
+        demux_ = demux;
+        dec_ = dec;
+        sws_ = sws;
+        enc_ = enc;
+        mux_ = mux;
+        index_ = index;
+        oindex_ = oindex;
+
+        packetq_.reset(new gspscqueue<std::shared_ptr<AVPacket>>(queuesize));
+        frameq_.reset(new gspscqueue<std::shared_ptr<AVFrame>>(queuesize));
+        scaledq_.reset(new gspscqueue<std::shared_ptr<AVFrame>>(queuesize));
+        opacketq_.reset(new gspscqueue<std::shared_ptr<AVPacket>>(queuesize));
+
+        return 0;
+    }
+
+    int gpipeline::start(gexecutor* executor/* = nullptr*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        if (demux_ == nullptr || packetq_ == nullptr)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+
+        // 封装的时基在写头之后才确定
+        int ret = mux_->get_timebase(oindex_, muxtb_);
+        CHECKFFRET(ret);
+
+        executor_ = executor;
+        {
+            std::lock_guard<std::mutex> lck(latencymutex_);
+            capturetime_.clear();
+            encodetime_.clear();
+            latency_.reset();
+        }
+        eof_ = false;
+        lastpts_ = AV_NOPTS_VALUE;
+        running_ = STAGE_NB;
+        auto now = av_gettime_relative();
+        for (auto& stage : stages_)
+        {
+            stage.ended = false;
+            stage.pushed = 0;
+            stage.popped = 0;
+            stage.sched = TASK_IDLE;
+            stage.finished = false;
+            stage.inputs = 0;
+            stage.outputs = 0;
+            stage.busyus = 0;
+            stage.starttime = now;
+            stage.endtime = 0;
+        }
+
+        getstatus() = WORKING;
+
+        for (int i = 0; i < STAGE_NB; ++i)
+        {
+            // 读取输入会阻塞(实时输入, 网络), 解封装始终使用自己的线程, 不占用executor的工作线程
+            if (executor_ != nullptr && i != STAGE_DEMUX)
+            {
+                schedule(static_cast<PIPELINESTAGE>(i));
+            }
+            else
+            {
+                stages_[i].worker = std::thread(&gpipeline::run, this, static_cast<PIPELINESTAGE>(i));
+            }
+        }
+
+        return 0;
+    }
+
+    int gpipeline::wait()
+    {
+        {
+            LOCK();
+            CHECKNOTSTOP();
+        }
+
+        // 不持有对象锁等待, 其他线程可以调用stop/flush/cleanup结束实时输入
+        // 工作线程由持有对象锁的drain/abort回收
+        wait_done();
+
+        return 0;
+    }
+
+    int gpipeline::flush()
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        drain();
+
+        return 0;
+    }
+
+    int gpipeline::stop()
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        drain();
+        // 释放各阶段, 之后不再访问调用者的对象
+        release();
+
+        return 0;
+    }
+
+    int gpipeline::get_stage_stats(PIPELINESTAGE stage, gstagestats& stats)
+    {
+        if (stage < 0 || stage >= STAGE_NB)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+
+        const auto& state = stages_[stage];
+        auto end = state.endtime.load();
+        if (end == 0)
+        {
+            end = av_gettime_relative();
+        }
+
+        stats.inputs = state.inputs;
+        stats.outputs = state.outputs;
+        stats.busyus = state.busyus;
+        stats.elapsedus = end - state.starttime;
+        stats.fps = stats.elapsedus > 0 ? stats.outputs * 1000000.0 / stats.elapsedus : 0;
+        stats.load = stats.elapsedus > 0 ? static_cast<double>(stats.busyus) / stats.elapsedus : 0;
+
+        return 0;
+    }
+
+    int gpipeline::get_latency_stats(glatencystats& stats)
+    {
+        return latency_.get_stats(stats);
+    }
+
+    int gpipeline::get_latency_buckets(std::vector<std::pair<int64_t, uint64_t>>& buckets)
+    {
+        return latency_.get_buckets(buckets);
+    }
+
+    void gpipeline::latency_capture(int64_t pts, int64_t time)
+    {
+        if (pts == AV_NOPTS_VALUE)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lck(latencymutex_);
+        capturetime_[pts] = time;
+        if (capturetime_.size() > PIPELINE_LATENCY_PENDING)
+        {
+            capturetime_.erase(capturetime_.begin());
+        }
+    }
+
+    void gpipeline::latency_encode(int64_t pts, int64_t encpts)
+    {
+        std::lock_guard<std::mutex> lck(latencymutex_);
+        auto it = capturetime_.find(pts);
+        if (it == capturetime_.end())
+        {
+            return;
+        }
+
+        encodetime_[encpts] = it->second;
+        if (encodetime_.size() > PIPELINE_LATENCY_PENDING)
+        {
+            encodetime_.erase(encodetime_.begin());
+        }
+        // 解码输出按pts递增, 更早的记录对应的帧已被丢弃
+        capturetime_.erase(capturetime_.begin(), ++it);
+    }
+
+    void gpipeline::latency_mux(int64_t encpts, int64_t time)
+    {
+        std::lock_guard<std::mutex> lck(latencymutex_);
+        auto it = encodetime_.find(encpts);
+        if (it == encodetime_.end())
+        {
+            return;
+        }
+
+        latency_.record(time - it->second);
+        // 有B帧时包不按pts输出, 只删除当前记录
+        encodetime_.erase(it);
+    }
+
+    void gpipeline::abort()
+    {
+        eof_ = true;
+        if (demux_ != nullptr)
+        {
+            // 解封装可能阻塞在读取上
+            demux_->cancel();
+        }
+        if (packetq_ != nullptr)
+        {
+            packetq_->close();
+            frameq_->close();
+            scaledq_->close();
+            opacketq_->close();
+        }
+        if (executor_ != nullptr)
+        {
+            // 空闲的阶段需要调度一次才能看到队列关闭
+            for (int i = 0; i < STAGE_NB; ++i)
+            {
+                schedule(static_cast<PIPELINESTAGE>(i));
+            }
+        }
+        join();
+        executor_ = nullptr;
+    }
+
+    void gpipeline::drain()
+    {
+        // 解封装阶段看到结束标记后向下游发送空指针, 解码器和编码器依次排空
+        // 取消解封装, 阻塞在实时输入上的读取立即返回
+        eof_ = true;
+        demux_->cancel();
+        join();
+    }
+
+    void gpipeline::wait_done()
+    {
+        std::unique_lock<std::mutex> lck(donemutex_);
+        donecv_.wait(lck, [this]() { return running_ == 0; });
+    }
+
+    void gpipeline::join()
+    {
+        wait_done();
+        for (auto& stage : stages_)
+        {
+            if (stage.worker.joinable())
+            {
+                stage.worker.join();
+            }
+        }
+    }
+
+    void gpipeline::run(PIPELINESTAGE stage)
+    {
+        STEP ret = STEP_PROGRESS;
+        while ((ret = step(stage, true)) != STEP_END)
+        {
+            if (ret == STEP_RETRY)
+            {
+                // 输入暂时没有数据(EAGAIN)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        finish(stage);
+    }
+
+    void gpipeline::schedule(PIPELINESTAGE stage)
+    {
+        auto& state = stages_[stage];
+        // 解封装在自己的线程上阻塞等待, 不需要调度
+        if (state.finished || stage == STAGE_DEMUX)
+        {
+            return;
+        }
+
+        int sched = state.sched.load();
+        for (;;)
+        {
+            if (sched == TASK_IDLE)
+            {
+                if (state.sched.compare_exchange_weak(sched, TASK_QUEUED))
+                {
+                    if (executor_->submit([this, stage]() { runtask(stage); }) < 0)
+                    {
+                        finish(stage);
+                    }
+                    return;
+                }
+            }
+            else if (sched == TASK_QUEUED)
+            {
+                // 正在执行或已排队, 通知它执行完后再检查一次
+                if (state.sched.compare_exchange_weak(sched, TASK_NOTIFIED))
+                {
+                    return;
+                }
+            }
+            else
+            {
+                return;
+            }
+        }
+    }
+
+    void gpipeline::runtask(PIPELINESTAGE stage)
+    {
+        auto& state = stages_[stage];
+        for (;;)
+        {
+            STEP ret = STEP_IDLE;
+            for (int i = 0; i < PIPELINE_QUANTUM; ++i)
+            {
+                auto pushed = state.pushed;
+                auto popped = state.popped;
+                ret = step(stage, false);
+                // 输出队列有了数据唤醒下游, 输入队列有了空间唤醒上游
+                if (state.pushed != pushed && stage + 1 < STAGE_NB)
+                {
+                    schedule(static_cast<PIPELINESTAGE>(stage + 1));
+                }
+                if (state.popped != popped && stage > 0)
+                {
+                    schedule(static_cast<PIPELINESTAGE>(stage - 1));
+                }
+                if (ret != STEP_PROGRESS)
+                {
+                    break;
+                }
+            }
+
+            if (ret == STEP_END)
+            {
+                finish(stage);
+                return;
+            }
+            if (ret == STEP_PROGRESS || ret == STEP_RETRY)
+            {
+                if (ret == STEP_RETRY)
+                {
+                    // 暂时没有数据(EAGAIN), 等待后再提交, 不在工作线程上空转
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                // 时间片用完, 排到队尾让其他任务先执行
+                state.sched = TASK_QUEUED;
+                if (executor_->submit([this, stage]() { runtask(stage); }) < 0)
+                {
+                    finish(stage);
+                }
+                return;
+            }
+
+            // 没有可做的工作, 执行期间没有被通知则进入空闲
+            int sched = TASK_QUEUED;
+            if (state.sched.compare_exchange_strong(sched, TASK_IDLE))
+            {
+                return;
+            }
+            state.sched = TASK_QUEUED;
+        }
+    }
+
+    void gpipeline::finish(PIPELINESTAGE stage)
+    {
+        auto& state = stages_[stage];
+        if (state.finished.exchange(true))
+        {
+            return;
+        }
+        state.endtime = av_gettime_relative();
+
+        std::lock_guard<std::mutex> lck(donemutex_);
+        --running_;
+        donecv_.notify_all();
+    }
+
+    gpipeline::STEP gpipeline::step(PIPELINESTAGE stage, bool block)
+    {
+        switch (stage)
+        {
+        case STAGE_DEMUX:
+            return step_demux(block);
+        case STAGE_DECODE:
+            return step_decode(block);
+        case STAGE_SCALE:
+            return step_scale(block);
+        case STAGE_ENCODE:
+            return step_encode(block);
+        case STAGE_MUX:
+            return step_mux(block);
+        default:
+            return STEP_END;
+        }
+    }
+
+    gpipeline::STEP gpipeline::step_demux(bool block)
+    {
+        auto& state = stages_[STAGE_DEMUX];
+        auto pushed = state.pushed;
+        bool ok = push_pending(*packetq_, demuxout_, block, state.pushed);
+        if (executor_ != nullptr && state.pushed != pushed)
+        {
+            // 解封装线程推入数据后立即调度解码, 不等下一次读取返回
+            schedule(STAGE_DECODE);
+        }
+        if (!ok)
+        {
+            return block || packetq_->closed() ? STEP_END : STEP_IDLE;
+        }
+        if (state.ended)
+        {
+            return STEP_END;
+        }
+        if (eof_)
+        {
+            demuxout_.push_back(nullptr);
+            state.ended = true;
+            return STEP_PROGRESS;
+        }
+
+        std::shared_ptr<AVPacket> packet;
+        int64_t readtime = 0;
+        int ret = packetpool_.get_packet(packet);
+        if (ret == 0)
+        {
+            auto begin = av_gettime_relative();
+            ret = demux_->readpacket(packet);
+            readtime = av_gettime_relative();
+            state.busyus += readtime - begin;
+        }
+        if (ret == AVERROR(EAGAIN))
+        {
+            return STEP_RETRY;
+        }
+        if (ret < 0)
+        {
+            if (ret != AVERROR_EOF && !(ret == AVERROR_EXIT && eof_))
+            {
+                av_log(nullptr, AV_LOG_ERROR, "%s %d : %d %s\n", __FILE__, __LINE__, ret, av_err2str(ret));
+            }
+            demuxout_.push_back(nullptr);
+            state.ended = true;
+            return STEP_PROGRESS;
+        }
+        ++state.inputs;
+
+        if (packet->stream_index != index_)
+        {
+            return STEP_PROGRESS;
+        }
+
+        latency_capture(packet->pts, readtime);
+
+        demuxout_.push_back(std::move(packet));
+        ++state.outputs;
+
+        return STEP_PROGRESS;
+    }
+
+    gpipeline::STEP gpipeline::step_decode(bool block)
+    {
+        auto& state = stages_[STAGE_DECODE];
+        if (!push_pending(*frameq_, decout_, block, state.pushed))
+        {
+            return block || frameq_->closed() ? STEP_END : STEP_IDLE;
+        }
+        if (state.ended)
+        {
+            return STEP_END;
+        }
+
+        std::shared_ptr<AVPacket> packet;
+        if (!pop_input(*packetq_, packet, block, state.popped))
+        {
+            return block || packetq_->closed() ? STEP_END : STEP_IDLE;
+        }
+        ++state.inputs;
+
+        // 空指针让解码器排空缓存的帧
+        bool eos = packet == nullptr;
+
+        auto begin = av_gettime_relative();
+        dec_->decode_all(packet, [this, &state](const std::shared_ptr<AVFrame>& frame) {
+            if (frame->pts == AV_NOPTS_VALUE)
+            {
+                frame->pts = frame->best_effort_timestamp;
+            }
+            decout_.push_back(frame);
+            ++state.outputs;
+            return 0;
+            });
+        state.busyus += av_gettime_relative() - begin;
+
+        if (eos)
+        {
+            decout_.push_back(nullptr);
+            state.ended = true;
+        }
+
+        return STEP_PROGRESS;
+    }
+
+    gpipeline::STEP gpipeline::step_scale(bool block)
+    {
+        auto& state = stages_[STAGE_SCALE];
+        if (!push_pending(*scaledq_, scaleout_, block, state.pushed))
+        {
+            return block || scaledq_->closed() ? STEP_END : STEP_IDLE;
+        }
+        if (state.ended)
+        {
+            return STEP_END;
+        }
+
+        std::shared_ptr<AVFrame> frame;
+        if (!pop_input(*frameq_, frame, block, state.popped))
+        {
+            return block || frameq_->closed() ? STEP_END : STEP_IDLE;
+        }
+        ++state.inputs;
+
+        if (frame == nullptr)
+        {
+            scaleout_.push_back(nullptr);
+            state.ended = true;
+            return STEP_PROGRESS;
+        }
+
+        // 格式和编码输入一致时直接传递
+        if (frame->format == encfmt_ && frame->width == encw_ && frame->height == ench_)
+        {
+            scaleout_.push_back(std::move(frame));
+            ++state.outputs;
+            return STEP_PROGRESS;
+        }
+
+        auto begin = av_gettime_relative();
+        auto sws = sws_;
+        int ret = 0;
+        if (sws == nullptr)
+        {
+            if (!autoswscreated_)
+            {
+                ret = autosws_.create_sws(static_cast<AVPixelFormat>(frame->format), frame->width, frame->height,
+                    encfmt_, encw_, ench_);
+                autoswscreated_ = ret == 0;
+            }
+            sws = &autosws_;
+        }
+
+        std::shared_ptr<AVFrame> scaled;
+        if (ret == 0)
+        {
+            ret = framepool_.get_frame(scaled, encw_, ench_, encfmt_, 0);
+        }
+        if (ret == 0)
+        {
+            ret = sws->scale(frame->data, frame->linesize, 0, frame->height, scaled->data, scaled->linesize);
+        }
+        state.busyus += av_gettime_relative() - begin;
+
+        if (ret < 0)
+        {
+            // 丢弃无法转换的帧
+            av_log(nullptr, AV_LOG_ERROR, "%s %d : %d %s\n", __FILE__, __LINE__, ret, av_err2str(ret));
+            return STEP_PROGRESS;
+        }
+
+        scaled->pts = frame->pts;
+        scaleout_.push_back(std::move(scaled));
+        ++state.outputs;
+
+        return STEP_PROGRESS;
+    }
+
+    gpipeline::STEP gpipeline::step_encode(bool block)
+    {
+        auto& state = stages_[STAGE_ENCODE];
+        if (!push_pending(*opacketq_, encout_, block, state.pushed))
+        {
+            return block || opacketq_->closed() ? STEP_END : STEP_IDLE;
+        }
+        if (state.ended)
+        {
+            return STEP_END;
+        }
+
+        std::shared_ptr<AVFrame> frame;
+        if (!pop_input(*scaledq_, frame, block, state.popped))
+        {
+            return block || scaledq_->closed() ? STEP_END : STEP_IDLE;
+        }
+        ++state.inputs;
+
+        auto begin = av_gettime_relative();
+        if (frame != nullptr)
+        {
+            auto inpts = frame->pts;
+            // 转换到编码时基, 编码器要求时间戳递增
+            if (frame->pts != AV_NOPTS_VALUE)
+            {
+                frame->pts = av_rescale_q(frame->pts, intb_, enctb_);
+            }
+            if (lastpts_ != AV_NOPTS_VALUE && (frame->pts == AV_NOPTS_VALUE || frame->pts <= lastpts_))
+            {
+                frame->pts = lastpts_ + 1;
+            }
+            lastpts_ = frame->pts;
+            if (inpts != AV_NOPTS_VALUE)
+            {
+                latency_encode(inpts, frame->pts);
+            }
+        }
+
+        // 取出编码器当前可输出的所有包
+        auto receive = [&]()
+        {
+            for (;;)
+            {
+                std::shared_ptr<AVPacket> packet;
+                if (packetpool_.get_packet(packet) < 0 ||
+                    enc_->encode_get_packet(packet) < 0)
+                {
+                    break;
+                }
+                encout_.push_back(std::move(packet));
+                ++state.outputs;
+            }
+        };
+
+        // 空帧排空编码器
+        int ret = enc_->encode_push_frame(frame);
+        if (ret == AVERROR(EAGAIN))
+        {
+            receive();
+            ret = enc_->encode_push_frame(frame);
+        }
+        if (ret < 0)
+        {
+            av_log(nullptr, AV_LOG_ERROR, "%s %d : %d %s\n", __FILE__, __LINE__, ret, av_err2str(ret));
+        }
+        receive();
+        state.busyus += av_gettime_relative() - begin;
+
+        if (frame == nullptr)
+        {
+            encout_.push_back(nullptr);
+            state.ended = true;
+        }
+
+        return STEP_PROGRESS;
+    }
+
+    gpipeline::STEP gpipeline::step_mux(bool block)
+    {
+        auto& state = stages_[STAGE_MUX];
+        if (state.ended)
+        {
+            return STEP_END;
+        }
+
+        std::shared_ptr<AVPacket> packet;
+        if (!pop_input(*opacketq_, packet, block, state.popped))
+        {
+            return block || opacketq_->closed() ? STEP_END : STEP_IDLE;
+        }
+        ++state.inputs;
+
+        if (packet == nullptr)
+        {
+            state.ended = true;
+            return STEP_END;
+        }
+
+        auto encpts = packet->pts;
+        av_packet_rescale_ts(packet.get(), enctb_, muxtb_);
+        packet->stream_index = oindex_;
+
+        auto begin = av_gettime_relative();
+        int ret = mux_->write_packet(packet);
+        auto end = av_gettime_relative();
+        state.busyus += end - begin;
+        if (ret < 0)
+        {
+            av_log(nullptr, AV_LOG_ERROR, "%s %d : %d %s\n", __FILE__, __LINE__, ret, av_err2str(ret));
+        }
+        else
+        {
+            ++state.outputs;
+            if (encpts != AV_NOPTS_VALUE)
+            {
+                latency_mux(encpts, end);
+            }
+        }
+
+        return STEP_PROGRESS;
+    }
+}//gff
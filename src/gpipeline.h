@@ -0,0 +1,244 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gpipeline.h
+*  简要描述:    转码流水线
+*
+*  作者:  gongluck
+*  说明:    gdemux->gdec->gsws->genc->gmux, 阶段之间用有界队列连接
+*           每个阶段一个工作线程, 或者解封装一个线程, 其他阶段在共享的gexecutor上调度
+*           队列中的空指针表示流结束
+*
+*******************************************************************/
+
+#ifndef __GPIPELINE_H__
+#define __GPIPELINE_H__
+
+#include "gavbase.h"
+#include "gutil.h"
+#include "gqueue.h"
+#include "gexecutor.h"
+#include "gdemux.h"
+#include "gdec.h"
+#include "gsws.h"
+#include "genc.h"
+#include "gmux.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <thread>
+
+namespace gff
+{
+    // 流水线阶段
+    typedef enum PIPELINESTAGE { STAGE_DEMUX, STAGE_DECODE, STAGE_SCALE, STAGE_ENCODE, STAGE_MUX, STAGE_NB } PIPELINESTAGE;
+
+    // 阶段统计
+    typedef struct gstagestats
+    {
+        uint64_t inputs;    // 输入个数
+        uint64_t outputs;   // 输出个数
+        int64_t busyus;     // 处理耗时(微秒)
+        int64_t elapsedus;  // 运行时长(微秒)
+        double fps;         // 输出速率(个/秒)
+        double load;        // 处理耗时占运行时长的比例, 接近1的阶段是瓶颈
+    } gstagestats;
+
+    class gpipeline : public gavbase
+    {
+    public:
+        ~gpipeline();
+
+        /*
+         * @brief   立即停止并清理资源, 不排空队列, 取消解封装的阻塞读取
+         * @return  错误码
+        */
+        int cleanup() override;
+
+        /*
+         * @brief               设置各阶段
+         * @return              错误码
+         * @param demux[in]     已打开的解封装, 会开启时间戳规整(gdemux::set_normalize)
+         * @param index[in]     输入流索引
+         * @param dec[in]       已设置参数的解码器
+         * @param sws[in]       已创建的帧转换, 为空时按第一帧和编码参数自动创建
+         * @param enc[in]       已设置参数的编码器
+         * @param mux[in]       已写头的封装
+         * @param oindex[in]    输出流索引
+         * @param queuesize[in] 阶段之间的队列长度
+        */
+        int set_stages(gdemux* demux, int index, gdec* dec, gsws* sws, genc* enc, gmux* mux, int oindex, size_t queuesize = 64);
+
+        /*
+         * @brief               启动
+         * @return              错误码
+         * @param executor[in]  为空时每个阶段一个工作线程
+         *                      否则解封装使用自己的线程(读取会阻塞), 其他阶段只在输入有数据且输出有空间时提交到executor执行
+        */
+        int start(gexecutor* executor = nullptr);
+
+        /*
+         * @brief   等待输入结束且所有数据写入封装
+         *          等待时不持有对象锁, 实时输入可以在其他线程调用stop结束
+         * @return  错误码
+        */
+        int wait();
+
+        /*
+         * @brief   停止读取输入, 排空解码器和编码器(送空帧)并写入封装, 完成后返回
+         *          解封装被取消(gdemux::cancel), 阻塞在实时输入上的读取立即返回, 之后解封装需要重新打开
+         * @return  错误码
+        */
+        int flush();
+
+        /*
+         * @brief   flush后结束流水线并释放各阶段的引用, 之后需要重新set_stages
+         * @return  错误码
+        */
+        int stop();
+
+        /*
+         * @brief               获取阶段统计
+         * @return              错误码
+         * @param stage[in]     阶段
+         * @param stats[out]    接收统计
+        */
+        int get_stage_stats(PIPELINESTAGE stage, gstagestats& stats);
+
+        /*
+         * @brief               获取从读到输入包到写入封装的延时统计
+         * @return              错误码
+         * @param stats[out]    接收统计
+        */
+        int get_latency_stats(glatencystats& stats);
+
+        /*
+         * @brief               获取延时直方图
+         * @return              错误码
+         * @param buckets[out]  接收(桶上界(微秒), 样本数)
+        */
+        int get_latency_buckets(std::vector<std::pair<int64_t, uint64_t>>& buckets);
+
+    private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
+        // 单步结果
+        typedef enum STEP { STEP_PROGRESS, STEP_IDLE, STEP_RETRY, STEP_END } STEP;
+
+        // 调度状态
+        typedef enum TASKSTATE { TASK_IDLE, TASK_QUEUED, TASK_NOTIFIED } TASKSTATE;
+
+        // 阶段状态
+        struct stagestate
+        {
+            std::thread worker;
+            bool ended = false;
+            // 本阶段推入输出队列和取出输入队列的个数, 用于判断是否需要唤醒相邻阶段
+            uint64_t pushed = 0;
+            uint64_t popped = 0;
+            std::atomic<int> sched{ TASK_IDLE };
+            std::atomic<bool> finished{ false };
+            std::atomic<uint64_t> inputs{ 0 };
+            std::atomic<uint64_t> outputs{ 0 };
+            std::atomic<int64_t> busyus{ 0 };
+            std::atomic<int64_t> starttime{ 0 };
+            std::atomic<int64_t> endtime{ 0 };
+        };
+
+        // 执行一步, block为真时在队列上阻塞等待
+        STEP step(PIPELINESTAGE stage, bool block);
+        STEP step_demux(bool block);
+        STEP step_decode(bool block);
+        STEP step_scale(bool block);
+        STEP step_encode(bool block);
+        STEP step_mux(bool block);
+
+        // 阶段工作线程
+        void run(PIPELINESTAGE stage);
+
+        // 在executor上调度阶段
+        void schedule(PIPELINESTAGE stage);
+
+        // executor任务, 执行一个时间片
+        void runtask(PIPELINESTAGE stage);
+
+        // 阶段结束
+        void finish(PIPELINESTAGE stage);
+
+        // 关闭所有队列并等待工作线程退出
+        void abort();
+
+        // 停止读取输入并等待排空
+        void drain();
+
+        // 等待所有阶段结束
+        void wait_done();
+
+        // 等待所有阶段结束并回收工作线程, 调用前需已加锁
+        void join();
+
+        // 按时间戳记录和查找读取时间
+        void latency_capture(int64_t pts, int64_t time);
+        void latency_encode(int64_t pts, int64_t encpts);
+        void latency_mux(int64_t encpts, int64_t time);
+
+        gdemux* demux_ = nullptr;
+        gdec* dec_ = nullptr;
+        gsws* sws_ = nullptr;
+        genc* enc_ = nullptr;
+        gmux* mux_ = nullptr;
+        int index_ = -1;
+        int oindex_ = -1;
+
+        // 时基和编码输入格式
+        AVRational intb_ = { 0, 1 };
+        AVRational enctb_ = { 0, 1 };
+        AVRational muxtb_ = { 0, 1 };
+        int encw_ = 0;
+        int ench_ = 0;
+        AVPixelFormat encfmt_ = AV_PIX_FMT_NONE;
+
+        // 阶段之间的队列
+        std::unique_ptr<gspscqueue<std::shared_ptr<AVPacket>>> packetq_;
+        std::unique_ptr<gspscqueue<std::shared_ptr<AVFrame>>> frameq_;
+        std::unique_ptr<gspscqueue<std::shared_ptr<AVFrame>>> scaledq_;
+        std::unique_ptr<gspscqueue<std::shared_ptr<AVPacket>>> opacketq_;
+
+        // 各阶段输出队列满时暂存的数据
+        std::deque<std::shared_ptr<AVPacket>> demuxout_;
+        std::deque<std::shared_ptr<AVFrame>> decout_;
+        std::deque<std::shared_ptr<AVFrame>> scaleout_;
+        std::deque<std::shared_ptr<AVPacket>> encout_;
+
+        stagestate stages_[STAGE_NB];
+        gexecutor* executor_ = nullptr;
+        std::atomic<bool> eof_{ false };
+
+        // 未结束的阶段数
+        std::mutex donemutex_;
+        std::condition_variable donecv_;
+        int running_ = 0;
+
+        // 编码时基下上一帧的pts
+        int64_t lastpts_ = AV_NOPTS_VALUE;
+
+        // 读取时间, 输入时基pts和编码时基pts分别对应
+        std::mutex latencymutex_;
+        std::map<int64_t, int64_t> capturetime_;
+        std::map<int64_t, int64_t> encodetime_;
+        glatencyhistogram latency_;
+
+        // 未指定帧转换时自动创建
+        gsws autosws_;
+        bool autoswscreated_ = false;
+
+        gframepool framepool_;
+        gpacketpool packetpool_;
+    };
+}//gff
+
+#endif//__GPIPELINE_H__
@@ -0,0 +1,421 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gqueue.h
+*  简要描述:    有界无锁队列
+*
+*  作者:  gongluck
+*  说明:    gspscqueue单生产者单消费者, gmpmcqueue多生产者多消费者
+*           元素存放在预分配的环形数组中, 入队出队不分配内存
+*           只有阻塞等待时才使用互斥锁和条件变量
+*
+*******************************************************************/
+
+#ifndef __GQUEUE_H__
+#define __GQUEUE_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace gff
+{
+    // 缓存行大小
+    const size_t GQUEUE_CACHELINE = 64;
+
+    // 阻塞等待辅助, 没有等待者时通知不加锁
+    class gqueuewaiter
+    {
+    public:
+        /*
+         * @brief               等待条件成立
+         * @return              条件是否成立
+         * @param pred[in]      条件
+         * @param deadline[in]  截止时间
+        */
+        template<typename PRED>
+        bool wait_until(PRED pred, std::chrono::steady_clock::time_point deadline)
+        {
+            // 短暂自旋, 避免队列很快就绪时进入内核等待
+            for (int i = 0; i < SPINCOUNT; ++i)
+            {
+                if (pred())
+                {
+                    return true;
+                }
+            }
+
+            std::unique_lock<std::mutex> lck(mutex_);
+            waiters_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool ret = true;
+            if (deadline == std::chrono::steady_clock::time_point::max())
+            {
+                cv_.wait(lck, pred);
+            }
+            else
+            {
+                ret = cv_.wait_until(lck, deadline, pred);
+            }
+            waiters_.fetch_sub(1);
+            return ret;
+        }
+
+        // 唤醒所有等待者
+        void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiters_.load(std::memory_order_relaxed) > 0)
+            {
+                std::lock_guard<std::mutex> lck(mutex_);
+                cv_.notify_all();
+            }
+        }
+
+    private:
+        static const int SPINCOUNT = 64;
+        std::atomic<int> waiters_{ 0 };
+        std::mutex mutex_;
+        std::condition_variable cv_;
+    };
+
+    // 阻塞接口, QUEUE需要实现try_push/try_pop/size/capacity
+    template<typename QUEUE, typename T>
+    class gqueuebase
+    {
+    public:
+        /*
+         * @brief               阻塞入队, 队列满时等待
+         * @return              成功返回true, 队列关闭或超时返回false
+         * @param item[in]      元素, 失败时不会被移走
+         * @param timeout[in]   超时
+        */
+        bool push(T&& item, std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+        {
+            auto deadline = make_deadline(timeout);
+            do
+            {
+                if (closed())
+                {
+                    return false;
+                }
+                if (self().try_push(std::move(item)))
+                {
+                    return true;
+                }
+            } while (waiter_.wait_until([this]() { return closed() || self().size() < self().capacity(); }, deadline));
+
+            return !closed() && self().try_push(std::move(item));
+        }
+
+        /*
+         * @brief               阻塞出队, 队列空时等待
+         * @return              成功返回true, 队列关闭且为空或超时返回false
+         * @param item[out]     接收元素
+         * @param timeout[in]   超时
+        */
+        bool pop(T& item, std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+        {
+            auto deadline = make_deadline(timeout);
+            do
+            {
+                if (self().try_pop(item))
+                {
+                    return true;
+                }
+                if (closed())
+                {
+                    // 关闭前入队的元素仍可取出
+                    return self().try_pop(item);
+                }
+            } while (waiter_.wait_until([this]() { return closed() || self().size() > 0; }, deadline));
+
+            return self().try_pop(item);
+        }
+
+        /*
+         * @brief   关闭队列, 唤醒所有等待者, 之后入队都会失败
+        */
+        void close()
+        {
+            closed_.store(true);
+            waiter_.notify();
+        }
+
+        /*
+         * @brief   重新打开已关闭的队列
+        */
+        void reopen()
+        {
+            closed_.store(false);
+        }
+
+        // 是否已关闭
+        bool closed() const
+        {
+            return closed_.load(std::memory_order_acquire);
+        }
+
+        // 是否为空
+        bool empty() const
+        {
+            return static_cast<const QUEUE*>(this)->size() == 0;
+        }
+
+    protected:
+        // 容量向上取整为2的幂
+        static size_t roundup(size_t capacity)
+        {
+            size_t n = 2;
+            while (n < capacity)
+            {
+                n <<= 1;
+            }
+            return n;
+        }
+
+        gqueuewaiter waiter_;
+
+    private:
+        QUEUE& self()
+        {
+            return *static_cast<QUEUE*>(this);
+        }
+
+        static std::chrono::steady_clock::time_point make_deadline(std::chrono::milliseconds timeout)
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (timeout >= std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::time_point::max() - now))
+            {
+                return std::chrono::steady_clock::time_point::max();
+            }
+            return now + timeout;
+        }
+
+        std::atomic<bool> closed_{ false };
+    };
+
+    // 有界单生产者单消费者无锁队列
+    template<typename T>
+    class gspscqueue : public gqueuebase<gspscqueue<T>, T>
+    {
+    public:
+        /*
+         * @brief               构造
+         * @param capacity[in]  容量, 向上取整为2的幂
+        */
+        explicit gspscqueue(size_t capacity)
+            : mask_(this->roundup(capacity) - 1), slots_(mask_ + 1)
+        {
+        }
+        gspscqueue(const gspscqueue&) = delete;
+        gspscqueue& operator=(const gspscqueue&) = delete;
+
+        /*
+         * @brief           非阻塞入队, 只能在生产者线程调用
+         * @return          队列满返回false, 此时item不会被移走
+         * @param item[in]  元素
+        */
+        bool try_push(T&& item)
+        {
+            auto tail = tail_.load(std::memory_order_relaxed);
+            if (tail - headcache_ > mask_)
+            {
+                headcache_ = head_.load(std::memory_order_acquire);
+                if (tail - headcache_ > mask_)
+                {
+                    return false;
+                }
+            }
+            slots_[tail & mask_] = std::move(item);
+            tail_.store(tail + 1, std::memory_order_release);
+            this->waiter_.notify();
+            return true;
+        }
+
+        /*
+         * @brief           非阻塞出队, 只能在消费者线程调用
+         * @return          队列空返回false
+         * @param item[out] 接收元素
+        */
+        bool try_pop(T& item)
+        {
+            auto head = head_.load(std::memory_order_relaxed);
+            if (head == tailcache_)
+            {
+                tailcache_ = tail_.load(std::memory_order_acquire);
+                if (head == tailcache_)
+                {
+                    return false;
+                }
+            }
+            auto& slot = slots_[head & mask_];
+            item = std::move(slot);
+            // 不在队列里持有元素(例如shared_ptr的引用)
+            slot = T();
+            head_.store(head + 1, std::memory_order_release);
+            this->waiter_.notify();
+            return true;
+        }
+
+        // 当前元素个数
+        size_t size() const
+        {
+            auto head = head_.load(std::memory_order_acquire);
+            auto tail = tail_.load(std::memory_order_acquire);
+            return tail >= head ? tail - head : 0;
+        }
+
+        // 容量
+        size_t capacity() const
+        {
+            return mask_ + 1;
+        }
+
+    private:
+        const size_t mask_;
+        std::vector<T> slots_;
+
+        // 消费者使用
+        char pad0_[GQUEUE_CACHELINE];
+        std::atomic<size_t> head_{ 0 };
+        size_t tailcache_ = 0;
+
+        // 生产者使用
+        char pad1_[GQUEUE_CACHELINE];
+        std::atomic<size_t> tail_{ 0 };
+        size_t headcache_ = 0;
+        char pad2_[GQUEUE_CACHELINE];
+    };
+
+    // 有界多生产者多消费者无锁队列
+    template<typename T>
+    class gmpmcqueue : public gqueuebase<gmpmcqueue<T>, T>
+    {
+    public:
+        /*
+         * @brief               构造
+         * @param capacity[in]  容量, 向上取整为2的幂
+        */
+        explicit gmpmcqueue(size_t capacity)
+            : mask_(this->roundup(capacity) - 1), cells_(new cell[mask_ + 1])
+        {
+            for (size_t i = 0; i <= mask_; ++i)
+            {
+                cells_[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+        gmpmcqueue(const gmpmcqueue&) = delete;
+        gmpmcqueue& operator=(const gmpmcqueue&) = delete;
+
+        /*
+         * @brief           非阻塞入队
+         * @return          队列满返回false, 此时item不会被移走
+         * @param item[in]  元素
+        */
+        bool try_push(T&& item)
+        {
+            cell* c = nullptr;
+            auto pos = tail_.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                c = &cells_[pos & mask_];
+                auto seq = c->seq.load(std::memory_order_acquire);
+                auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+            c->data = std::move(item);
+            c->seq.store(pos + 1, std::memory_order_release);
+            this->waiter_.notify();
+            return true;
+        }
+
+        /*
+         * @brief           非阻塞出队
+         * @return          队列空返回false
+         * @param item[out] 接收元素
+        */
+        bool try_pop(T& item)
+        {
+            cell* c = nullptr;
+            auto pos = head_.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                c = &cells_[pos & mask_];
+                auto seq = c->seq.load(std::memory_order_acquire);
+                auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0)
+                {
+                    if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = head_.load(std::memory_order_relaxed);
+                }
+            }
+            item = std::move(c->data);
+            c->data = T();
+            c->seq.store(pos + mask_ + 1, std::memory_order_release);
+            this->waiter_.notify();
+            return true;
+        }
+
+        // 当前元素个数(近似值)
+        size_t size() const
+        {
+            auto head = head_.load(std::memory_order_acquire);
+            auto tail = tail_.load(std::memory_order_acquire);
+            return tail >= head ? tail - head : 0;
+        }
+
+        // 容量
+        size_t capacity() const
+        {
+            return mask_ + 1;
+        }
+
+    private:
+        struct cell
+        {
+            std::atomic<size_t> seq;
+            T data;
+        };
+
+        const size_t mask_;
+        std::unique_ptr<cell[]> cells_;
+
+        char pad0_[GQUEUE_CACHELINE];
+        std::atomic<size_t> head_{ 0 };
+        char pad1_[GQUEUE_CACHELINE];
+        std::atomic<size_t> tail_{ 0 };
+        char pad2_[GQUEUE_CACHELINE];
+    };
+}//gff
+
+#endif//__GQUEUE_H__
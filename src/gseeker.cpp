@@ -0,0 +1,283 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gseeker.cpp
+*  简要描述:    精确跳转
+*
+*  作者:  gongluck
+*  说明:
+*
+*******************************************************************/
+
+#include "gseeker.h"
+
+namespace gff
+{
+    gseeker::~gseeker()
+    {
+        cleanup();
+    }
+
+    int gseeker::cleanup()
+    {
+        LOCK();
+
+        return release();
+    }
+
+    int gseeker::release()
+    {
+        if (dec_ != nullptr && skipping_)
+        {
+            dec_->set_skip_frame(AVDISCARD_DEFAULT);
+        }
+        demux_ = nullptr;
+        dec_ = nullptr;
+        index_ = -1;
+        hasindex_ = false;
+        cur_.reset();
+        pending_.reset();
+        lastdts_ = AV_NOPTS_VALUE;
+        started_ = false;
+        eof_ = false;
+        draining_ = false;
+        skipping_ = false;
+        av_packet_unref(packet_.get());
+        getstatus() = STOP;
+
+        return 0;
+    }
+
+    int gseeker::open(gdemux* demux, int index, gdec* dec, int64_t maxforward/* = AV_TIME_BASE*/)
+    {
+        LOCK();
+        CHECKSTOP();
+
+        release();
+
+        if (demux == nullptr || dec == nullptr || index < 0)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+        const AVCodecParameters* par = nullptr;
+        int ret = demux->get_stream_par(index, par, timebase_);
+        CHECKFFRET(ret);
+
+        // 没有索引时按时长判断是否继续解码
+        gindexseek result;
+        hasindex_ = demux->find_index(index, 0, result) == 0;
+        demux_ = demux;
+        dec_ = dec;
+        index_ = index;
+        maxforward_ = av_rescale_q(maxforward, { 1, AV_TIME_BASE }, timebase_);
+        stats_ = gseekerstats();
+
+        getstatus() = WORKING;
+
+        return 0;
+    }
+
+    int gseeker::seek(int64_t timestamp, const std::shared_ptr<AVFrame>& frame, AVRational timebase/* = { 1, AV_TIME_BASE }*/)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        if (frame == nullptr)
+        {
+            CHECKFFRET(AVERROR(EINVAL));
+        }
+        ++stats_.requests;
+
+        int ret = 0;
+        auto ts = av_rescale_q(timestamp, timebase, timebase_);
+        auto base = cur_ != nullptr ? frame_pts(cur_) : (pending_ != nullptr ? frame_pts(pending_) : AV_NOPTS_VALUE);
+        bool forward = started_ && base != AV_NOPTS_VALUE && ts >= base;
+        if (forward && !eof_ && (pending_ == nullptr || ts >= frame_pts(pending_)))
+        {
+            if (hasindex_)
+            {
+                // 目标所需的关键帧已经送入解码器
+                gindexseek result;
+                forward = demux_->find_index(index_, ts, result) == 0 &&
+                    lastdts_ != AV_NOPTS_VALUE && result.keydts != AV_NOPTS_VALUE && result.keydts <= lastdts_;
+            }
+            else
+            {
+                forward = ts - base <= maxforward_;
+            }
+        }
+        if (forward)
+        {
+            ++stats_.forwards;
+        }
+        else
+        {
+            ret = reseek(ts);
+            CHECKFFRET(ret);
+            ++stats_.seeks;
+        }
+
+        for (;;)
+        {
+            if (pending_ == nullptr)
+            {
+                ret = next_frame(ts, pending_);
+                if (ret < 0)
+                {
+                    // 失败时pending_是没有数据的空帧
+                    pending_.reset();
+                }
+                if (ret == AVERROR_EOF)
+                {
+                    // 目标晚于最后一帧
+                    break;
+                }
+                CHECKFFRET(ret);
+            }
+
+            auto pts = frame_pts(pending_);
+            if (cur_ != nullptr && pts != AV_NOPTS_VALUE && pts > ts)
+            {
+                // 下一帧晚于目标, 留给之后的请求
+                break;
+            }
+            cur_ = std::move(pending_);
+            if (pts != AV_NOPTS_VALUE && (pts > ts || (cur_->pkt_duration > 0 && pts + cur_->pkt_duration > ts)))
+            {
+                // 目标早于第一帧, 或帧时长已经覆盖目标, 不需要再解码下一帧
+                break;
+            }
+        }
+
+        if (cur_ == nullptr)
+        {
+            CHECKFFRET(AVERROR_EOF);
+        }
+        av_frame_unref(frame.get());
+        ret = av_frame_ref(frame.get(), cur_.get());
+        CHECKFFRET(ret);
+
+        return 0;
+    }
+
+    int gseeker::get_stats(gseekerstats& stats)
+    {
+        LOCK();
+        CHECKNOTSTOP();
+
+        stats = stats_;
+
+        return 0;
+    }
+
+    int gseeker::reseek(int64_t timestamp)
+    {
+        int ret = 0;
+        if (hasindex_)
+        {
+            gindexseek result;
+            ret = demux_->seek_index(index_, timestamp, result);
+        }
+        else
+        {
+            ret = demux_->seek_frame(index_, timestamp, false);
+        }
+        CHECKFFRET(ret);
+        ret = dec_->flush();
+        CHECKFFRET(ret);
+
+        cur_.reset();
+        pending_.reset();
+        lastdts_ = AV_NOPTS_VALUE;
+        started_ = true;
+        eof_ = false;
+        draining_ = false;
+
+        return 0;
+    }
+
+    int gseeker::next_frame(int64_t timestamp, std::shared_ptr<AVFrame>& frame)
+    {
+        // 只取一次, 解码器没有输出时帧保持为空, 循环中继续使用
+        int ret = framepool_.get_frame(frame);
+        CHECKFFRET(ret);
+        for (;;)
+        {
+            // 先取解码器中已有的帧
+            ret = dec_->decode(nullptr, frame);
+            if (ret >= 0)
+            {
+                ++stats_.frames;
+                return 0;
+            }
+            if (ret == AVERROR_EOF || (ret == AVERROR(EAGAIN) && draining_))
+            {
+                eof_ = true;
+                return AVERROR_EOF;
+            }
+            CHECKFFRET(ret);
+
+            ret = demux_->readpacket(packet_);
+            if (ret == AVERROR(EAGAIN))
+            {
+                continue;
+            }
+            if (ret == AVERROR_EOF)
+            {
+                // 空包让解码器输出缓存的帧
+                av_packet_unref(packet_.get());
+                draining_ = true;
+                ret = dec_->decode(packet_, frame);
+                if (ret >= 0)
+                {
+                    ++stats_.frames;
+                    return 0;
+                }
+                if (ret == AVERROR_EOF)
+                {
+                    eof_ = true;
+                    return ret;
+                }
+                CHECKFFRET(ret);
+                continue;
+            }
+            CHECKFFRET(ret);
+            if (packet_->stream_index != index_)
+            {
+                continue;
+            }
+
+            // 显示结束不晚于目标的帧不会被返回, 其中的非参考帧不需要解码
+            bool skip = packet_->pts != AV_NOPTS_VALUE && packet_->duration > 0 && packet_->pts + packet_->duration <= timestamp;
+            if (skip != skipping_)
+            {
+                ret = dec_->set_skip_frame(skip ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+                CHECKFFRET(ret);
+                skipping_ = skip;
+            }
+            if (packet_->dts != AV_NOPTS_VALUE)
+            {
+                lastdts_ = packet_->dts;
+            }
+            ++stats_.packets;
+            if (skip)
+            {
+                ++stats_.skipped;
+            }
+
+            ret = dec_->decode(packet_, frame);
+            if (ret >= 0)
+            {
+                ++stats_.frames;
+                return 0;
+            }
+            CHECKFFRET(ret);
+        }
+    }
+
+    int64_t gseeker::frame_pts(const std::shared_ptr<AVFrame>& frame)
+    {
+        return frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+    }
+}//gff
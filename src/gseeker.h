@@ -0,0 +1,111 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gseeker.h
+*  简要描述:    精确跳转
+*
+*  作者:  gongluck
+*  说明:    获取指定时间显示的帧, 即pts不晚于目标时间的最后一帧
+*           目标在当前解码位置之后且不需要经过新的关键帧时继续解码, 不重新跳转
+*           不会显示的非参考帧设置skip_frame跳过解码
+*
+*******************************************************************/
+
+#ifndef __GSEEKER_H__
+#define __GSEEKER_H__
+
+#include "gavbase.h"
+#include "gutil.h"
+#include "gdemux.h"
+#include "gdec.h"
+
+namespace gff
+{
+    // 跳转统计
+    typedef struct gseekerstats
+    {
+        uint64_t requests;  // 请求次数
+        uint64_t seeks;     // 重新跳转的次数
+        uint64_t forwards;  // 继续解码不跳转的次数
+        uint64_t packets;   // 送入解码器的包数
+        uint64_t skipped;   // 设置了skip_frame送入的包数
+        uint64_t frames;    // 解码输出的帧数
+    } gseekerstats;
+
+    class gseeker : public gavbase
+    {
+    public:
+        ~gseeker();
+
+        /*
+         * @brief   清理资源
+         * @return  错误码
+        */
+        int cleanup() override;
+
+        /*
+         * @brief                   设置输入
+         *                          demux建立了index的索引时按索引跳转和判断是否在同一个GOP
+         * @return                  错误码
+         * @param demux[in]         已打开的解封装, 只读取index流的包
+         * @param index[in]         视频流索引
+         * @param dec[in]           已设置参数的解码器
+         * @param maxforward[in]    没有索引时, 目标与当前帧相差不超过这个时长(微秒)则继续解码
+        */
+        int open(gdemux* demux, int index, gdec* dec, int64_t maxforward = AV_TIME_BASE);
+
+        /*
+         * @brief                   获取指定时间显示的帧
+         * @return                  错误码
+         * @param timestamp[in]     目标时间
+         * @param frame[out]        接收帧(引用), 目标早于第一帧时为第一帧, 晚于最后一帧时为最后一帧
+         * @param timebase[in]      目标时间的时基
+        */
+        int seek(int64_t timestamp, const std::shared_ptr<AVFrame>& frame, AVRational timebase = { 1, AV_TIME_BASE });
+
+        /*
+         * @brief               获取统计
+         * @return              错误码
+         * @param stats[out]    接收统计
+        */
+        int get_stats(gseekerstats& stats);
+
+    private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
+        // 重新跳转到目标所在的关键帧
+        int reseek(int64_t timestamp);
+
+        // 获取下一个解码帧, 输入结束返回AVERROR_EOF
+        int next_frame(int64_t timestamp, std::shared_ptr<AVFrame>& frame);
+
+        // 帧的显示时间
+        static int64_t frame_pts(const std::shared_ptr<AVFrame>& frame);
+
+        gdemux* demux_ = nullptr;
+        gdec* dec_ = nullptr;
+        int index_ = -1;
+        AVRational timebase_ = { 0, 1 };
+        int64_t maxforward_ = 0;
+        bool hasindex_ = false;
+
+        // 当前帧(pts不晚于上次目标的最后一帧)和已解码但晚于上次目标的帧
+        std::shared_ptr<AVFrame> cur_;
+        std::shared_ptr<AVFrame> pending_;
+        // 最后送入解码器的包的dts
+        int64_t lastdts_ = AV_NOPTS_VALUE;
+        // 是否已跳转过, 是否已送空包, 解码器是否已排空, 当前是否设置了skip_frame
+        bool started_ = false;
+        bool draining_ = false;
+        bool eof_ = false;
+        bool skipping_ = false;
+
+        std::shared_ptr<AVPacket> packet_ = GetPacket();
+        gframepool framepool_;
+        gseekerstats stats_ = { 0 };
+    };
+}//gff
+
+#endif//__GSEEKER_H__
@@ -0,0 +1,458 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gstreaminfo.cpp
+*  简要描述:    流信息磁盘缓存
+*
+*  作者:  gongluck
+*  说明:
+*
+*******************************************************************/
+
+#include "gstreaminfo.h"
+#include "gutil.h"
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace gff
+{
+    // 缓存文件标识和版本, 字段变化时增加版本
+    static const char STREAMINFO_MAGIC[8] = { 'G', 'F', 'F', 'S', 'I', 'N', 'F', 'O' };
+    static const int32_t STREAMINFO_VERSION = 1;
+    // 附加数据上限
+    static const int32_t STREAMINFO_MAX_EXTRADATA = 1 << 20;
+    // 索引文件标识和版本
+    static const char STREAMINDEX_MAGIC[8] = { 'G', 'F', 'F', 'I', 'N', 'D', 'E', 'X' };
+    static const int32_t STREAMINDEX_VERSION = 1;
+
+    // 文件标识, 路径+大小+修改时间
+    static int file_key(const char* path, std::string& key)
+    {
+        int64_t size = 0, mtime = 0;
+        int ret = GetFileIdentity(path, size, mtime);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        key = std::string(path) + "|" + std::to_string(size) + "|" + std::to_string(mtime);
+        return 0;
+    }
+
+    int GetStreamInfoPath(const char* dir, const char* path, const char* ext, std::string& cachepath)
+    {
+        if (dir == nullptr || path == nullptr || ext == nullptr)
+        {
+            return AVERROR(EINVAL);
+        }
+        std::string key;
+        int ret = file_key(path, key);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for (auto c : key)
+        {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ULL;
+        }
+        char name[32] = { 0 };
+        snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+
+        cachepath = dir;
+        if (!cachepath.empty() && cachepath.back() != '/' && cachepath.back() != '\\')
+        {
+            cachepath += '/';
+        }
+        cachepath += name;
+        cachepath += ext;
+
+        return 0;
+    }
+
+    // 缓存的AVStream字段, AVStream的大小不属于ABI, 不能按值声明
+    struct gstreamfields
+    {
+        AVRational time_base = { 0, 1 };
+        int64_t start_time = 0;
+        int64_t duration = 0;
+        int64_t nb_frames = 0;
+        int disposition = 0;
+        AVRational sample_aspect_ratio = { 0, 1 };
+        AVRational avg_frame_rate = { 0, 1 };
+        AVRational r_frame_rate = { 0, 1 };
+    };
+
+    // 按固定顺序读写的流字段
+    template<typename IO, typename ST>
+    static void stream_fields(IO io, ST* st, AVCodecParameters* par)
+    {
+        io(st->time_base.num);
+        io(st->time_base.den);
+        io(st->start_time);
+        io(st->duration);
+        io(st->nb_frames);
+        io(st->disposition);
+        io(st->sample_aspect_ratio.num);
+        io(st->sample_aspect_ratio.den);
+        io(st->avg_frame_rate.num);
+        io(st->avg_frame_rate.den);
+        io(st->r_frame_rate.num);
+        io(st->r_frame_rate.den);
+
+        io(par->codec_type);
+        io(par->codec_id);
+        io(par->codec_tag);
+        io(par->format);
+        io(par->bit_rate);
+        io(par->bits_per_coded_sample);
+        io(par->bits_per_raw_sample);
+        io(par->profile);
+        io(par->level);
+        io(par->width);
+        io(par->height);
+        io(par->sample_aspect_ratio.num);
+        io(par->sample_aspect_ratio.den);
+        io(par->field_order);
+        io(par->color_range);
+        io(par->color_primaries);
+        io(par->color_trc);
+        io(par->color_space);
+        io(par->chroma_location);
+        io(par->video_delay);
+        io(par->channel_layout);
+        io(par->channels);
+        io(par->sample_rate);
+        io(par->block_align);
+        io(par->frame_size);
+        io(par->initial_padding);
+        io(par->trailing_padding);
+        io(par->seek_preroll);
+    }
+
+    int LoadStreamInfo(const char* dir, const char* path, AVFormatContext* fmtctx)
+    {
+        if (fmtctx == nullptr)
+        {
+            return AVERROR(EINVAL);
+        }
+        std::string cachepath, key;
+        int ret = GetStreamInfoPath(dir, path, ".gsi", cachepath);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        ret = file_key(path, key);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        std::ifstream f(cachepath, std::ios::binary);
+        if (!f)
+        {
+            return AVERROR(ENOENT);
+        }
+        auto rd = [&f](void* p, size_t n) { f.read(static_cast<char*>(p), n); };
+
+        char magic[sizeof(STREAMINFO_MAGIC)] = { 0 };
+        int32_t version = 0;
+        rd(magic, sizeof(magic));
+        rd(&version, sizeof(version));
+        if (!f || memcmp(magic, STREAMINFO_MAGIC, sizeof(magic)) != 0 || version != STREAMINFO_VERSION)
+        {
+            return AVERROR_INVALIDDATA;
+        }
+        int32_t keylen = 0;
+        rd(&keylen, sizeof(keylen));
+        if (!f || keylen != static_cast<int32_t>(key.size()))
+        {
+            return AVERROR_INVALIDDATA;
+        }
+        std::string cachedkey(keylen, '\0');
+        rd(&cachedkey[0], keylen);
+        int32_t nb_streams = 0;
+        rd(&nb_streams, sizeof(nb_streams));
+        if (!f || cachedkey != key || nb_streams != static_cast<int32_t>(fmtctx->nb_streams))
+        {
+            // 文件已变化或流在探测时才创建
+            return AVERROR_INVALIDDATA;
+        }
+
+        // 先读到临时流里, 全部有效后再写入
+        std::vector<gstreamfields> streams(nb_streams);
+        std::vector<std::shared_ptr<AVCodecParameters>> pars(nb_streams);
+        std::vector<std::vector<uint8_t>> extradatas(nb_streams);
+        int64_t duration = 0, start_time = 0, bit_rate = 0;
+        rd(&duration, sizeof(duration));
+        rd(&start_time, sizeof(start_time));
+        rd(&bit_rate, sizeof(bit_rate));
+        for (int32_t i = 0; i < nb_streams; ++i)
+        {
+            pars[i].reset(avcodec_parameters_alloc(), [](AVCodecParameters* p) { avcodec_parameters_free(&p); });
+            if (pars[i] == nullptr)
+            {
+                return AVERROR(ENOMEM);
+            }
+            stream_fields([&rd](auto& v) { int64_t t = 0; rd(&t, sizeof(t)); v = static_cast<std::remove_reference_t<decltype(v)>>(t); }, &streams[i], pars[i].get());
+
+            int32_t size = 0;
+            rd(&size, sizeof(size));
+            if (!f || size < 0 || size > STREAMINFO_MAX_EXTRADATA)
+            {
+                return AVERROR_INVALIDDATA;
+            }
+            extradatas[i].resize(size);
+            if (size > 0)
+            {
+                rd(extradatas[i].data(), size);
+            }
+
+            // 解封装已经识别的流必须一致
+            auto par = fmtctx->streams[i]->codecpar;
+            if ((par->codec_type != AVMEDIA_TYPE_UNKNOWN && par->codec_type != pars[i]->codec_type) ||
+                (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != pars[i]->codec_id))
+            {
+                return AVERROR_INVALIDDATA;
+            }
+        }
+        if (!f)
+        {
+            return AVERROR_INVALIDDATA;
+        }
+
+        for (int32_t i = 0; i < nb_streams; ++i)
+        {
+            auto st = fmtctx->streams[i];
+            auto extradata = static_cast<uint8_t*>(av_mallocz(extradatas[i].size() + AV_INPUT_BUFFER_PADDING_SIZE));
+            if (extradata == nullptr)
+            {
+                return AVERROR(ENOMEM);
+            }
+            if (!extradatas[i].empty())
+            {
+                memcpy(extradata, extradatas[i].data(), extradatas[i].size());
+            }
+
+            auto par = st->codecpar;
+            ret = avcodec_parameters_copy(par, pars[i].get());
+            if (ret < 0)
+            {
+                av_free(extradata);
+                return ret;
+            }
+            par->extradata = extradata;
+            par->extradata_size = static_cast<int>(extradatas[i].size());
+            st->time_base = streams[i].time_base;
+            st->start_time = streams[i].start_time;
+            st->duration = streams[i].duration;
+            st->nb_frames = streams[i].nb_frames;
+            st->disposition = streams[i].disposition;
+            st->sample_aspect_ratio = streams[i].sample_aspect_ratio;
+            st->avg_frame_rate = streams[i].avg_frame_rate;
+            st->r_frame_rate = streams[i].r_frame_rate;
+        }
+        fmtctx->duration = duration;
+        fmtctx->start_time = start_time;
+        fmtctx->bit_rate = bit_rate;
+
+        return 0;
+    }
+
+    int SaveStreamInfo(const char* dir, const char* path, const AVFormatContext* fmtctx)
+    {
+        if (fmtctx == nullptr)
+        {
+            return AVERROR(EINVAL);
+        }
+        std::string cachepath, key;
+        int ret = GetStreamInfoPath(dir, path, ".gsi", cachepath);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        ret = file_key(path, key);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        // 先写临时文件再改名, 并发打开同一文件时不会读到写了一半的缓存
+        auto tmppath = cachepath + ".tmp" + std::to_string(reinterpret_cast<uintptr_t>(fmtctx));
+        {
+            std::ofstream f(tmppath, std::ios::binary | std::ios::trunc);
+            if (!f)
+            {
+                return AVERROR(EIO);
+            }
+            auto wr = [&f](const void* p, size_t n) { f.write(static_cast<const char*>(p), n); };
+
+            wr(STREAMINFO_MAGIC, sizeof(STREAMINFO_MAGIC));
+            wr(&STREAMINFO_VERSION, sizeof(STREAMINFO_VERSION));
+            int32_t keylen = static_cast<int32_t>(key.size());
+            wr(&keylen, sizeof(keylen));
+            wr(key.data(), key.size());
+            int32_t nb_streams = static_cast<int32_t>(fmtctx->nb_streams);
+            wr(&nb_streams, sizeof(nb_streams));
+            wr(&fmtctx->duration, sizeof(fmtctx->duration));
+            wr(&fmtctx->start_time, sizeof(fmtctx->start_time));
+            wr(&fmtctx->bit_rate, sizeof(fmtctx->bit_rate));
+            for (unsigned int i = 0; i < fmtctx->nb_streams; ++i)
+            {
+                auto st = fmtctx->streams[i];
+                stream_fields([&wr](auto& v) { int64_t t = static_cast<int64_t>(v); wr(&t, sizeof(t)); }, st, st->codecpar);
+                int32_t size = st->codecpar->extradata != nullptr && st->codecpar->extradata_size <= STREAMINFO_MAX_EXTRADATA ?
+                    st->codecpar->extradata_size : 0;
+                wr(&size, sizeof(size));
+                if (size > 0)
+                {
+                    wr(st->codecpar->extradata, size);
+                }
+            }
+            if (!f)
+            {
+                f.close();
+                remove(tmppath.c_str());
+                return AVERROR(EIO);
+            }
+        }
+
+        remove(cachepath.c_str());
+        if (rename(tmppath.c_str(), cachepath.c_str()) != 0)
+        {
+            remove(tmppath.c_str());
+            return AVERROR(EIO);
+        }
+
+        return 0;
+    }
+
+    int LoadStreamIndex(const char* indexpath, const char* path, int index, std::vector<gindexentry>& entries)
+    {
+        if (indexpath == nullptr || path == nullptr)
+        {
+            return AVERROR(EINVAL);
+        }
+        std::string key;
+        int ret = file_key(path, key);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        std::ifstream f(indexpath, std::ios::binary);
+        if (!f)
+        {
+            return AVERROR(ENOENT);
+        }
+        auto rd = [&f](void* p, size_t n) { f.read(static_cast<char*>(p), n); };
+
+        char magic[sizeof(STREAMINDEX_MAGIC)] = { 0 };
+        int32_t version = 0;
+        rd(magic, sizeof(magic));
+        rd(&version, sizeof(version));
+        if (!f || memcmp(magic, STREAMINDEX_MAGIC, sizeof(magic)) != 0 || version != STREAMINDEX_VERSION)
+        {
+            return AVERROR_INVALIDDATA;
+        }
+        int32_t keylen = 0;
+        rd(&keylen, sizeof(keylen));
+        if (!f || keylen != static_cast<int32_t>(key.size()))
+        {
+            return AVERROR_INVALIDDATA;
+        }
+        std::string cachedkey(keylen, '\0');
+        rd(&cachedkey[0], keylen);
+        int32_t cachedindex = -1;
+        int64_t count = 0;
+        rd(&cachedindex, sizeof(cachedindex));
+        rd(&count, sizeof(count));
+        if (!f || cachedkey != key || cachedindex != index || count < 0)
+        {
+            return AVERROR_INVALIDDATA;
+        }
+
+        // 按文件剩余长度校验个数, 避免损坏的文件导致分配过大
+        auto cur = f.tellg();
+        f.seekg(0, std::ios::end);
+        auto end = f.tellg();
+        f.seekg(cur);
+        if (!f || end - cur != count * static_cast<int64_t>(sizeof(gindexentry)))
+        {
+            return AVERROR_INVALIDDATA;
+        }
+        std::vector<gindexentry> loaded(static_cast<size_t>(count));
+        if (count > 0)
+        {
+            rd(loaded.data(), loaded.size() * sizeof(gindexentry));
+        }
+        if (!f)
+        {
+            return AVERROR_INVALIDDATA;
+        }
+        entries.swap(loaded);
+
+        return 0;
+    }
+
+    int SaveStreamIndex(const char* indexpath, const char* path, int index, const std::vector<gindexentry>& entries)
+    {
+        if (indexpath == nullptr || path == nullptr)
+        {
+            return AVERROR(EINVAL);
+        }
+        std::string key;
+        int ret = file_key(path, key);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        std::string cachepath = indexpath;
+        auto tmppath = cachepath + ".tmp" + std::to_string(reinterpret_cast<uintptr_t>(&entries));
+        {
+            std::ofstream f(tmppath, std::ios::binary | std::ios::trunc);
+            if (!f)
+            {
+                return AVERROR(EIO);
+            }
+            auto wr = [&f](const void* p, size_t n) { f.write(static_cast<const char*>(p), n); };
+
+            wr(STREAMINDEX_MAGIC, sizeof(STREAMINDEX_MAGIC));
+            wr(&STREAMINDEX_VERSION, sizeof(STREAMINDEX_VERSION));
+            int32_t keylen = static_cast<int32_t>(key.size());
+            wr(&keylen, sizeof(keylen));
+            wr(key.data(), key.size());
+            int32_t streamindex = index;
+            int64_t count = static_cast<int64_t>(entries.size());
+            wr(&streamindex, sizeof(streamindex));
+            wr(&count, sizeof(count));
+            if (count > 0)
+            {
+                wr(entries.data(), entries.size() * sizeof(gindexentry));
+            }
+            if (!f)
+            {
+                f.close();
+                remove(tmppath.c_str());
+                return AVERROR(EIO);
+            }
+        }
+
+        remove(cachepath.c_str());
+        if (rename(tmppath.c_str(), cachepath.c_str()) != 0)
+        {
+            remove(tmppath.c_str());
+            return AVERROR(EIO);
+        }
+
+        return 0;
+    }
+}//gff
\ No newline at end of file
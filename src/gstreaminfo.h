@@ -0,0 +1,86 @@
+﻿/*******************************************************************
+*  Copyright(c) 2019
+*  All rights reserved.
+*
+*  文件名称:    gstreaminfo.h
+*  简要描述:    流信息磁盘缓存
+*
+*  作者:  gongluck
+*  说明:    按(路径,大小,修改时间)保存avformat_find_stream_info的结果
+*           再次打开同一文件时直接恢复流参数, 跳过探测
+*           关键帧索引也按同样的文件标识保存和校验
+*
+*******************************************************************/
+
+#ifndef __GSTREAMINFO_H__
+#define __GSTREAMINFO_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <libavformat/avformat.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <string>
+#include <vector>
+
+namespace gff
+{
+    // 索引项, 一个包一项
+    typedef struct gindexentry
+    {
+        int64_t pts;
+        int64_t dts;
+        int64_t pos;    // 包在输入中的字节位置, 未知为-1
+        int32_t size;   // 包大小
+        int32_t flags;  // AV_PKT_FLAG_KEY等
+    } gindexentry;
+
+    // 获取缓存文件路径, 文件不存在返回错误码
+    int GetStreamInfoPath(const char* dir, const char* path, const char* ext, std::string& cachepath);
+
+    /*
+     * @brief               从缓存恢复流参数
+     * @return              成功返回0, 没有缓存或与当前输入不匹配返回错误码
+     * @param dir[in]       缓存目录
+     * @param path[in]      输入文件路径
+     * @param fmtctx[in]    已avformat_open_input的上下文
+    */
+    int LoadStreamInfo(const char* dir, const char* path, AVFormatContext* fmtctx);
+
+    /*
+     * @brief               保存流参数到缓存
+     * @return              错误码
+     * @param dir[in]       缓存目录
+     * @param path[in]      输入文件路径
+     * @param fmtctx[in]    已avformat_find_stream_info的上下文
+    */
+    int SaveStreamInfo(const char* dir, const char* path, const AVFormatContext* fmtctx);
+
+    /*
+     * @brief               读取索引文件
+     * @return              成功返回0, 没有索引或与当前输入不匹配返回错误码
+     * @param indexpath[in] 索引文件路径
+     * @param path[in]      输入文件路径
+     * @param index[in]     流索引
+     * @param entries[out]  接收按解码顺序排列的索引项
+    */
+    int LoadStreamIndex(const char* indexpath, const char* path, int index, std::vector<gindexentry>& entries);
+
+    /*
+     * @brief               保存索引文件
+     * @return              错误码
+     * @param indexpath[in] 索引文件路径
+     * @param path[in]      输入文件路径
+     * @param index[in]     流索引
+     * @param entries[in]   按解码顺序排列的索引项
+    */
+    int SaveStreamIndex(const char* indexpath, const char* path, int index, const std::vector<gindexentry>& entries);
+}//gff
+
+#endif//__GSTREAMINFO_H__
@@ -24,6 +24,11 @@ namespace gff
     {
         LOCK();
 
+        return release();
+    }
+
+    int gswr::release()
+    {
         swr_free(&swrctx_);
         getstatus() = STOP;
 
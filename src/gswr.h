@@ -63,6 +63,9 @@ namespace gff
         int convert(uint8_t** out, int out_count, const uint8_t** in, int in_count);
 
     private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
         SwrContext* swrctx_ = nullptr;
     };
 }//gff
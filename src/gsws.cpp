@@ -24,6 +24,11 @@ namespace gff
     {
         LOCK();
 
+        return release();
+    }
+
+    int gsws::release()
+    {
         sws_freeContext(swsctx_);
         swsctx_ = nullptr;
         getstatus() = STOP;
@@ -36,7 +41,7 @@ namespace gff
         LOCK();
         CHECKSTOP();
 
-        cleanup();
+        release();
         swsctx_ = sws_getContext(sw, sh, spixfmt, dw, dh, dpixfmt, SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
         if (swsctx_ == nullptr)
         {
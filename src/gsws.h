@@ -64,6 +64,9 @@ namespace gff
         int scale(const uint8_t* const srcSlice[], const int srcStride[], int srcSliceY, int srcSliceH, uint8_t* const dst[], const int dstStride[]);
 
     private:
+        // 释放资源, 调用前需已加锁
+        int release();
+
         SwsContext* swsctx_ = nullptr;
     };
 }//gff
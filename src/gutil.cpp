@@ -12,6 +12,23 @@
 
 #include "gutil.h"
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <libavutil/time.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
 namespace gff
 {
 	AVPacket* CreatePacket()
@@ -45,7 +62,7 @@ namespace gff
 		return std::shared_ptr<AVFrame>(CreateFrame(), FreeFrame);
 	}
 
-	int GetFrameBuf(std::shared_ptr<AVFrame> frame, int w, int h, AVPixelFormat fmt, int align)
+	int GetFrameBuf(const std::shared_ptr<AVFrame>& frame, int w, int h, AVPixelFormat fmt, int align)
 	{
 		if (frame == nullptr)
 		{
@@ -61,7 +78,7 @@ namespace gff
 		}
 	}
 
-	int GetFrameBuf(std::shared_ptr<AVFrame> frame, int samples, uint64_t layout, AVSampleFormat fmt, int align)
+	int GetFrameBuf(const std::shared_ptr<AVFrame>& frame, int samples, uint64_t layout, AVSampleFormat fmt, int align)
 	{
 		if (frame == nullptr)
 		{
@@ -77,7 +94,7 @@ namespace gff
 		}
 	}
 
-	int frame_make_writable(std::shared_ptr<AVFrame> frame)
+	int frame_make_writable(const std::shared_ptr<AVFrame>& frame)
 	{
 		if (frame == nullptr)
 		{
@@ -87,8 +104,738 @@ namespace gff
 		return av_frame_make_writable(frame.get());
 	}
 
-	int hwframe_to_frame(std::shared_ptr<AVFrame> hwframe, std::shared_ptr<AVFrame> frame)
+	int hwframe_to_frame(const std::shared_ptr<AVFrame>& hwframe, const std::shared_ptr<AVFrame>& frame)
 	{
 		return av_hwframe_transfer_data(frame.get(), hwframe.get(), 0);
 	}
+
+	int GetFileIdentity(const char* path, int64_t& size, int64_t& mtime)
+	{
+		if (path == nullptr)
+		{
+			CHECKFFRET(AVERROR(EINVAL));
+		}
+
+#ifdef _WIN32
+		auto len = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+		if (len <= 0)
+		{
+			CHECKFFRET(AVERROR(EINVAL));
+		}
+		std::vector<wchar_t> wpath(len);
+		MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath.data(), len);
+		WIN32_FILE_ATTRIBUTE_DATA attr;
+		if (!GetFileAttributesExW(wpath.data(), GetFileExInfoStandard, &attr))
+		{
+			return AVERROR(ENOENT);
+		}
+		size = (static_cast<int64_t>(attr.nFileSizeHigh) << 32) | attr.nFileSizeLow;
+		mtime = (static_cast<int64_t>(attr.ftLastWriteTime.dwHighDateTime) << 32) | attr.ftLastWriteTime.dwLowDateTime;
+#else
+		struct stat st;
+		if (stat(path, &st) != 0)
+		{
+			return AVERROR(errno);
+		}
+		size = st.st_size;
+		mtime = static_cast<int64_t>(st.st_mtime);
+#endif
+
+		return 0;
+	}
+
+	// 缓存的空闲控制块上限
+	static const size_t BLOCKCACHE_MAX_IDLE = 256;
+
+	// shared_ptr控制块缓存, 缓冲池取出帧和包时不再分配控制块
+	// 同一个缓冲池的控制块大小相同, 只缓存第一次归还的大小
+	struct gblockcache
+	{
+		std::mutex mutex;
+		std::vector<void*> blocks;
+		size_t blocksize = 0;
+
+		~gblockcache()
+		{
+			for (auto b : blocks)
+			{
+				::operator delete(b);
+			}
+		}
+
+		void* get(size_t size)
+		{
+			{
+				std::lock_guard<std::mutex> _lock(mutex);
+				if (size == blocksize && !blocks.empty())
+				{
+					auto b = blocks.back();
+					blocks.pop_back();
+					return b;
+				}
+			}
+			return ::operator new(size);
+		}
+
+		void put(void* b, size_t size)
+		{
+			{
+				std::lock_guard<std::mutex> _lock(mutex);
+				if (blocksize == 0)
+				{
+					blocksize = size;
+				}
+				if (size == blocksize && blocks.size() < BLOCKCACHE_MAX_IDLE)
+				{
+					blocks.push_back(b);
+					return;
+				}
+			}
+			::operator delete(b);
+		}
+	};
+
+	// 从gblockcache分配控制块的分配器
+	// 控制块持有分配器副本, 缓存在最后一个控制块释放后才销毁
+	template<typename T>
+	struct gblockalloc
+	{
+		typedef T value_type;
+
+		explicit gblockalloc(const std::shared_ptr<gblockcache>& cache)
+			: cache(cache)
+		{
+		}
+		template<typename U>
+		gblockalloc(const gblockalloc<U>& other)
+			: cache(other.cache)
+		{
+		}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(cache->get(n * sizeof(T)));
+		}
+		void deallocate(T* p, size_t n)
+		{
+			cache->put(p, n * sizeof(T));
+		}
+
+		template<typename U>
+		bool operator==(const gblockalloc<U>& other) const
+		{
+			return cache == other.cache;
+		}
+		template<typename U>
+		bool operator!=(const gblockalloc<U>& other) const
+		{
+			return cache != other.cache;
+		}
+
+		std::shared_ptr<gblockcache> cache;
+	};
+
+	// 默认行对齐
+	static const int FRAMEPOOL_DEFAULT_ALIGN = 32;
+	// 缓存的空闲AVFrame上限
+	static const size_t FRAMEPOOL_MAX_IDLE = 64;
+
+	// 缓冲池状态,由缓冲池和取出的帧共同持有
+	struct gframepool::poolstate
+	{
+		std::mutex mutex;
+		std::map<std::tuple<int, int, int, int>, AVBufferPool*> pools;
+		std::vector<AVFrame*> idles;
+		std::shared_ptr<gblockcache> blocks = std::make_shared<gblockcache>();
+		uint64_t gets = 0;
+		uint64_t misses = 0;
+
+		~poolstate()
+		{
+			for (auto& p : pools)
+			{
+				av_buffer_pool_uninit(&p.second);
+			}
+			for (auto f : idles)
+			{
+				av_frame_free(&f);
+			}
+		}
+
+		// AVBufferPool分配回调,只在池中没有空闲缓冲区时调用
+		static AVBufferRef* alloc(void* opaque, int size)
+		{
+			auto buf = av_buffer_alloc(size);
+			if (buf != nullptr)
+			{
+				++static_cast<poolstate*>(opaque)->misses;
+			}
+			return buf;
+		}
+
+		// 帧的最后一个引用释放
+		static void release(const std::shared_ptr<poolstate>& state, AVFrame* p)
+		{
+			// 数据缓冲区在这里归还AVBufferPool
+			av_frame_unref(p);
+
+			std::lock_guard<std::mutex> _lock(state->mutex);
+			if (state->idles.size() < FRAMEPOOL_MAX_IDLE)
+			{
+				state->idles.push_back(p);
+			}
+			else
+			{
+				av_frame_free(&p);
+			}
+		}
+
+		// 取出空闲AVFrame,调用者持有锁
+		AVFrame* take()
+		{
+			AVFrame* p = nullptr;
+			if (!idles.empty())
+			{
+				p = idles.back();
+				idles.pop_back();
+			}
+			else
+			{
+				p = av_frame_alloc();
+			}
+			return p;
+		}
+
+		// 包装成shared_ptr,最后一个引用释放时归还
+		static std::shared_ptr<AVFrame> wrap(const std::shared_ptr<poolstate>& state, AVFrame* p)
+		{
+			auto deleter = [state](AVFrame* p) { release(state, p); };
+			return std::shared_ptr<AVFrame>(p, deleter, gblockalloc<AVFrame>(state->blocks));
+		}
+	};
+
+	gframepool::gframepool()
+		: state_(std::make_shared<poolstate>())
+	{
+	}
+
+	gframepool::~gframepool()
+	{
+		cleanup();
+	}
+
+	int gframepool::get_frame(std::shared_ptr<AVFrame>& frame, int w, int h, AVPixelFormat fmt, int align)
+	{
+		if (align <= 0)
+		{
+			align = FRAMEPOOL_DEFAULT_ALIGN;
+		}
+		auto size = av_image_get_buffer_size(fmt, w, h, align);
+		CHECKFFRET(size);
+
+		// frame可能持有本缓冲池最后一个引用, 释放时会加锁, 只能在解锁后赋值
+		std::shared_ptr<AVFrame> result;
+		{
+			std::lock_guard<std::mutex> _lock(state_->mutex);
+
+			auto key = std::make_tuple(w, h, static_cast<int>(fmt), align);
+			auto it = state_->pools.find(key);
+			if (it == state_->pools.end())
+			{
+				auto pool = av_buffer_pool_init2(size + AV_INPUT_BUFFER_PADDING_SIZE, state_.get(), poolstate::alloc, nullptr);
+				if (pool == nullptr)
+				{
+					CHECKFFRET(AVERROR(ENOMEM));
+				}
+				it = state_->pools.emplace(key, pool).first;
+			}
+
+			auto p = state_->take();
+			if (p == nullptr)
+			{
+				CHECKFFRET(AVERROR(ENOMEM));
+			}
+
+			p->buf[0] = av_buffer_pool_get(it->second);
+			if (p->buf[0] == nullptr)
+			{
+				state_->idles.push_back(p);
+				CHECKFFRET(AVERROR(ENOMEM));
+			}
+			++state_->gets;
+
+			int ret = av_image_fill_arrays(p->data, p->linesize, p->buf[0]->data, fmt, w, h, align);
+			if (ret < 0)
+			{
+				av_frame_unref(p);
+				state_->idles.push_back(p);
+				CHECKFFRET(ret);
+			}
+			p->extended_data = p->data;
+			p->width = w;
+			p->height = h;
+			p->format = fmt;
+
+			result = poolstate::wrap(state_, p);
+		}
+		frame = std::move(result);
+
+		return 0;
+	}
+
+	int gframepool::get_frame(std::shared_ptr<AVFrame>& frame)
+	{
+		// frame可能持有本缓冲池最后一个引用, 释放时会加锁, 只能在解锁后赋值
+		std::shared_ptr<AVFrame> result;
+		{
+			std::lock_guard<std::mutex> _lock(state_->mutex);
+
+			auto p = state_->take();
+			if (p == nullptr)
+			{
+				CHECKFFRET(AVERROR(ENOMEM));
+			}
+
+			result = poolstate::wrap(state_, p);
+		}
+		frame = std::move(result);
+
+		return 0;
+	}
+
+	int gframepool::get_stats(uint64_t& hits, uint64_t& misses)
+	{
+		std::lock_guard<std::mutex> _lock(state_->mutex);
+
+		misses = state_->misses;
+		hits = state_->gets - state_->misses;
+
+		return 0;
+	}
+
+	int gframepool::cleanup()
+	{
+		std::lock_guard<std::mutex> _lock(state_->mutex);
+
+		// 已取出的缓冲区在最后一个引用释放后由AVBufferPool自行回收
+		for (auto& p : state_->pools)
+		{
+			av_buffer_pool_uninit(&p.second);
+		}
+		state_->pools.clear();
+		for (auto f : state_->idles)
+		{
+			av_frame_free(&f);
+		}
+		state_->idles.clear();
+
+		return 0;
+	}
+
+	// 数据缓冲区最小分级(2^10)
+	static const int PACKETPOOL_MIN_SHIFT = 10;
+	// 数据缓冲区最大分级(2^24),更大的数据直接分配
+	static const int PACKETPOOL_MAX_SHIFT = 24;
+	// 缓存的空闲AVPacket上限
+	static const size_t PACKETPOOL_MAX_IDLE = 256;
+
+	// 缓冲池状态,由缓冲池和取出的包共同持有
+	struct gpacketpool::poolstate
+	{
+		std::mutex mutex;
+		AVBufferPool* pools[PACKETPOOL_MAX_SHIFT - PACKETPOOL_MIN_SHIFT + 1] = { nullptr };
+		std::vector<AVPacket*> idles;
+		std::shared_ptr<gblockcache> blocks = std::make_shared<gblockcache>();
+		gpacketpoolstats stats = { 0 };
+
+		~poolstate()
+		{
+			for (auto& pool : pools)
+			{
+				av_buffer_pool_uninit(&pool);
+			}
+			for (auto p : idles)
+			{
+				av_packet_free(&p);
+			}
+		}
+
+		// AVBufferPool分配回调,只在池中没有空闲缓冲区时调用
+		static AVBufferRef* alloc(void* opaque, int size)
+		{
+			auto buf = av_buffer_alloc(size);
+			if (buf != nullptr)
+			{
+				++static_cast<poolstate*>(opaque)->stats.bufmisses;
+			}
+			return buf;
+		}
+
+		// 包的最后一个引用释放
+		static void release(const std::shared_ptr<poolstate>& state, AVPacket* p)
+		{
+			// 数据缓冲区在这里归还AVBufferPool
+			av_packet_unref(p);
+
+			std::lock_guard<std::mutex> _lock(state->mutex);
+			if (state->idles.size() < PACKETPOOL_MAX_IDLE)
+			{
+				state->idles.push_back(p);
+			}
+			else
+			{
+				av_packet_free(&p);
+			}
+		}
+
+		// 取出空闲AVPacket,调用者持有锁
+		AVPacket* take()
+		{
+			AVPacket* p = nullptr;
+			if (!idles.empty())
+			{
+				p = idles.back();
+				idles.pop_back();
+				++stats.packethits;
+			}
+			else if ((p = CreatePacket()) != nullptr)
+			{
+				++stats.packetmisses;
+			}
+			return p;
+		}
+
+		// 包装成shared_ptr,最后一个引用释放时归还
+		static std::shared_ptr<AVPacket> wrap(const std::shared_ptr<poolstate>& state, AVPacket* p)
+		{
+			auto deleter = [state](AVPacket* p) { release(state, p); };
+			return std::shared_ptr<AVPacket>(p, deleter, gblockalloc<AVPacket>(state->blocks));
+		}
+
+		// 获取数据缓冲区,调用者持有锁
+		AVBufferRef* getbuf(int size)
+		{
+			int shift = PACKETPOOL_MIN_SHIFT;
+			while (shift <= PACKETPOOL_MAX_SHIFT && (1 << shift) < size + AV_INPUT_BUFFER_PADDING_SIZE)
+			{
+				++shift;
+			}
+			if (shift > PACKETPOOL_MAX_SHIFT)
+			{
+				auto buf = av_buffer_alloc(size + AV_INPUT_BUFFER_PADDING_SIZE);
+				if (buf != nullptr)
+				{
+					++stats.bufmisses;
+				}
+				return buf;
+			}
+
+			auto& pool = pools[shift - PACKETPOOL_MIN_SHIFT];
+			if (pool == nullptr &&
+				(pool = av_buffer_pool_init2(1 << shift, this, alloc, nullptr)) == nullptr)
+			{
+				return nullptr;
+			}
+			auto misses = stats.bufmisses;
+			auto buf = av_buffer_pool_get(pool);
+			if (buf != nullptr && stats.bufmisses == misses)
+			{
+				++stats.bufhits;
+			}
+			return buf;
+		}
+	};
+
+	gpacketpool::gpacketpool()
+		: state_(std::make_shared<poolstate>())
+	{
+	}
+
+	gpacketpool::~gpacketpool()
+	{
+		cleanup();
+	}
+
+	int gpacketpool::get_packet(std::shared_ptr<AVPacket>& packet)
+	{
+		// packet可能持有本缓冲池最后一个引用, 释放时会加锁, 只能在解锁后赋值
+		std::shared_ptr<AVPacket> result;
+		{
+			std::lock_guard<std::mutex> _lock(state_->mutex);
+
+			auto p = state_->take();
+			if (p == nullptr)
+			{
+				CHECKFFRET(AVERROR(ENOMEM));
+			}
+
+			result = poolstate::wrap(state_, p);
+		}
+		packet = std::move(result);
+
+		return 0;
+	}
+
+	int gpacketpool::get_packet(std::shared_ptr<AVPacket>& packet, int size)
+	{
+		if (size < 0 || size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+		{
+			CHECKFFRET(AVERROR(EINVAL));
+		}
+
+		// packet可能持有本缓冲池最后一个引用, 释放时会加锁, 只能在解锁后赋值
+		std::shared_ptr<AVPacket> result;
+		{
+			std::lock_guard<std::mutex> _lock(state_->mutex);
+
+			auto p = state_->take();
+			if (p == nullptr)
+			{
+				CHECKFFRET(AVERROR(ENOMEM));
+			}
+			p->buf = state_->getbuf(size);
+			if (p->buf == nullptr)
+			{
+				state_->idles.push_back(p);
+				CHECKFFRET(AVERROR(ENOMEM));
+			}
+			p->data = p->buf->data;
+			p->size = size;
+			memset(p->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+			result = poolstate::wrap(state_, p);
+		}
+		packet = std::move(result);
+
+		return 0;
+	}
+
+	int gpacketpool::get_stats(gpacketpoolstats& stats)
+	{
+		std::lock_guard<std::mutex> _lock(state_->mutex);
+
+		stats = state_->stats;
+
+		return 0;
+	}
+
+	int gpacketpool::cleanup()
+	{
+		std::lock_guard<std::mutex> _lock(state_->mutex);
+
+		// 已取出的缓冲区在最后一个引用释放后由AVBufferPool自行回收
+		for (auto& pool : state_->pools)
+		{
+			av_buffer_pool_uninit(&pool);
+		}
+		for (auto p : state_->idles)
+		{
+			av_packet_free(&p);
+		}
+		state_->idles.clear();
+
+		return 0;
+	}
+
+	glatencyhistogram::glatencyhistogram()
+	{
+		reset();
+	}
+
+	int glatencyhistogram::bucket_index(int64_t us)
+	{
+		if (us < 4)
+		{
+			return us < 0 ? 0 : static_cast<int>(us);
+		}
+
+		// 最高位决定区间, 其后两位决定区间内的桶
+		int e = 2;
+		while ((us >> (e + 1)) != 0)
+		{
+			++e;
+		}
+		int index = 4 * (e - 1) + static_cast<int>((us >> (e - 2)) & 3);
+		return index < BUCKETS ? index : BUCKETS - 1;
+	}
+
+	int64_t glatencyhistogram::bucket_upper(int index)
+	{
+		// 下一个桶的下界减1
+		++index;
+		if (index < 4)
+		{
+			return index - 1;
+		}
+		int e = index / 4 + 1;
+		return ((4LL + index % 4) << (e - 2)) - 1;
+	}
+
+	void glatencyhistogram::record(int64_t us)
+	{
+		if (us < 0)
+		{
+			us = 0;
+		}
+
+		buckets_[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(us, std::memory_order_relaxed);
+
+		auto cur = min_.load(std::memory_order_relaxed);
+		while (us < cur && !min_.compare_exchange_weak(cur, us, std::memory_order_relaxed));
+		cur = max_.load(std::memory_order_relaxed);
+		while (us > cur && !max_.compare_exchange_weak(cur, us, std::memory_order_relaxed));
+	}
+
+	int glatencyhistogram::get_stats(glatencystats& stats)
+	{
+		uint64_t counts[BUCKETS] = { 0 };
+		uint64_t total = 0;
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			counts[i] = buckets_[i].load(std::memory_order_relaxed);
+			total += counts[i];
+		}
+
+		stats = { 0 };
+		stats.count = total;
+		if (total == 0)
+		{
+			return 0;
+		}
+		stats.minus = min_.load(std::memory_order_relaxed);
+		stats.maxus = max_.load(std::memory_order_relaxed);
+		stats.meanus = sum_.load(std::memory_order_relaxed) / static_cast<int64_t>(total);
+
+		// 第一个累计样本数达到目标的桶
+		auto percentile = [&](double p)
+		{
+			auto target = static_cast<uint64_t>(total * p + 0.5);
+			target = target == 0 ? 1 : target;
+			uint64_t sum = 0;
+			for (int i = 0; i < BUCKETS; ++i)
+			{
+				sum += counts[i];
+				if (sum >= target)
+				{
+					return bucket_upper(i) < stats.maxus ? bucket_upper(i) : stats.maxus;
+				}
+			}
+			return stats.maxus;
+		};
+		stats.p50us = percentile(0.5);
+		stats.p90us = percentile(0.9);
+		stats.p99us = percentile(0.99);
+
+		return 0;
+	}
+
+	int glatencyhistogram::get_buckets(std::vector<std::pair<int64_t, uint64_t>>& buckets)
+	{
+		buckets.clear();
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			auto n = buckets_[i].load(std::memory_order_relaxed);
+			if (n > 0)
+			{
+				buckets.push_back(std::make_pair(bucket_upper(i), n));
+			}
+		}
+
+		return 0;
+	}
+
+	int glatencyhistogram::reset()
+	{
+		for (auto& bucket : buckets_)
+		{
+			bucket = 0;
+		}
+		count_ = 0;
+		sum_ = 0;
+		min_ = INT64_MAX;
+		max_ = 0;
+
+		return 0;
+	}
+
+	void gcanceltoken::cancel()
+	{
+		cancelled_.store(true);
+	}
+
+	void gcanceltoken::reset()
+	{
+		cancelled_.store(false);
+	}
+
+	bool gcanceltoken::cancelled() const
+	{
+		return cancelled_.load(std::memory_order_relaxed);
+	}
+
+	giointerrupt::giointerrupt()
+		: owntoken_(std::make_shared<gcanceltoken>()), token_(owntoken_)
+	{
+	}
+
+	void giointerrupt::set_token(const std::shared_ptr<gcanceltoken>& token)
+	{
+		token_ = token != nullptr ? token : owntoken_;
+	}
+
+	void giointerrupt::cancel()
+	{
+		token_->cancel();
+	}
+
+	void giointerrupt::reset()
+	{
+		owntoken_->reset();
+	}
+
+	void giointerrupt::abort()
+	{
+		aborted_.store(true);
+	}
+
+	void giointerrupt::resume()
+	{
+		aborted_.store(false);
+	}
+
+	void giointerrupt::set_timeout(int64_t timeoutus)
+	{
+		timeout_ = timeoutus > 0 ? timeoutus : 0;
+	}
+
+	void giointerrupt::begin()
+	{
+		auto timeout = timeout_.load();
+		deadline_ = timeout > 0 ? av_gettime_relative() + timeout : 0;
+	}
+
+	void giointerrupt::end()
+	{
+		deadline_ = 0;
+	}
+
+	AVIOInterruptCB giointerrupt::get_callback()
+	{
+		AVIOInterruptCB cb = { interrupt, this };
+		return cb;
+	}
+
+	int giointerrupt::interrupt(void* opaque)
+	{
+		// 阻塞的I/O会反复调用, 只做原子读取
+		auto self = static_cast<giointerrupt*>(opaque);
+		if (self->aborted_.load(std::memory_order_relaxed) || self->token_->cancelled())
+		{
+			return 1;
+		}
+		auto deadline = self->deadline_.load(std::memory_order_relaxed);
+		return deadline > 0 && av_gettime_relative() > deadline ? 1 : 0;
+	}
 }//gff
\ No newline at end of file
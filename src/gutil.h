@@ -22,7 +22,9 @@ extern "C"
 
 #include <libavutil/opt.h>
 #include <libavutil/audio_fifo.h>
+#include <libavutil/imgutils.h>
 #include <libavcodec/avcodec.h>
+#include <libavformat/avio.h>
 
 #ifdef __cplusplus
 }
@@ -60,7 +62,11 @@ if (ret < 0 && ret != AVERROR(EAGAIN))\
 // 锁
 #define LOCK() std::lock_guard<decltype(getmutex())> _lock(getmutex())
 
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <tuple>
+#include <vector>
 namespace gff
 {
     // 获取AVPacet
@@ -69,14 +75,240 @@ namespace gff
     std::shared_ptr<AVFrame> GetFrame();
 
     // 分配AVFrame数据空间
-    int GetFrameBuf(std::shared_ptr<AVFrame> frame, int w, int h, AVPixelFormat fmt, int align);
-    int GetFrameBuf(std::shared_ptr<AVFrame> frame, int samples, uint64_t layout, AVSampleFormat fmt, int align);
+    int GetFrameBuf(const std::shared_ptr<AVFrame>& frame, int w, int h, AVPixelFormat fmt, int align);
+    int GetFrameBuf(const std::shared_ptr<AVFrame>& frame, int samples, uint64_t layout, AVSampleFormat fmt, int align);
 
     // 确保能写frame
-    int frame_make_writable(std::shared_ptr<AVFrame> frame);
+    int frame_make_writable(const std::shared_ptr<AVFrame>& frame);
+
+    // 获取文件大小和修改时间, 用于判断文件是否变化, path为UTF-8
+    int GetFileIdentity(const char* path, int64_t& size, int64_t& mtime);
 
     // 获取硬解码数据
-    int hwframe_to_frame(std::shared_ptr<AVFrame> hwframe, std::shared_ptr<AVFrame> frame);
+    int hwframe_to_frame(const std::shared_ptr<AVFrame>& hwframe, const std::shared_ptr<AVFrame>& frame);
+
+    // AVFrame缓冲池
+    // 按(宽,高,格式,对齐)分组, 帧的最后一个引用释放时AVFrame和数据缓冲区都归还缓冲池
+    // shared_ptr的控制块也由缓冲池复用, 取帧不分配堆内存
+    class gframepool
+    {
+    public:
+        gframepool();
+        ~gframepool();
+        gframepool(const gframepool&) = delete;
+        gframepool& operator=(const gframepool&) = delete;
+
+        /*
+         * @brief               从缓冲池获取已分配数据空间的AVFrame
+         * @return              错误码
+         * @param frame[out]    接收AVFrame
+         * @param w[in]         宽
+         * @param h[in]         高
+         * @param fmt[in]       像素格式
+         * @param align[in]     行对齐,小于等于0时使用默认对齐
+        */
+        int get_frame(std::shared_ptr<AVFrame>& frame, int w, int h, AVPixelFormat fmt, int align);
+
+        /*
+         * @brief               从缓冲池获取空的AVFrame, 用于接收解码输出
+         * @return              错误码
+         * @param frame[out]    接收AVFrame
+        */
+        int get_frame(std::shared_ptr<AVFrame>& frame);
+
+        /*
+         * @brief               获取缓冲池统计
+         * @return              错误码
+         * @param hits[out]     复用次数
+         * @param misses[out]   新分配次数
+        */
+        int get_stats(uint64_t& hits, uint64_t& misses);
+
+        /*
+         * @brief   清理空闲资源,已取出的帧不受影响
+         * @return  错误码
+        */
+        int cleanup();
+
+    private:
+        struct poolstate;
+        std::shared_ptr<poolstate> state_;
+    };
+
+    // AVPacket缓冲池统计
+    typedef struct gpacketpoolstats
+    {
+        uint64_t packethits;    // AVPacket复用次数
+        uint64_t packetmisses;  // AVPacket新分配次数
+        uint64_t bufhits;       // 数据缓冲区复用次数
+        uint64_t bufmisses;     // 数据缓冲区新分配次数
+    } gpacketpoolstats;
+
+    // AVPacket缓冲池
+    // AVPacket和数据缓冲区都在最后一个引用释放时归还, 数据缓冲区按2的幂大小分级复用
+    // shared_ptr的控制块也由缓冲池复用
+    class gpacketpool
+    {
+    public:
+        gpacketpool();
+        ~gpacketpool();
+        gpacketpool(const gpacketpool&) = delete;
+        gpacketpool& operator=(const gpacketpool&) = delete;
+
+        /*
+         * @brief               从缓冲池获取空的AVPacket
+         * @return              错误码
+         * @param packet[out]   接收AVPacket
+        */
+        int get_packet(std::shared_ptr<AVPacket>& packet);
+
+        /*
+         * @brief               从缓冲池获取带数据缓冲区的AVPacket
+         * @return              错误码
+         * @param packet[out]   接收AVPacket
+         * @param size[in]      数据大小(不含填充)
+        */
+        int get_packet(std::shared_ptr<AVPacket>& packet, int size);
+
+        /*
+         * @brief               获取缓冲池统计
+         * @return              错误码
+         * @param stats[out]    接收统计
+        */
+        int get_stats(gpacketpoolstats& stats);
+
+        /*
+         * @brief   清理空闲资源,已取出的AVPacket不受影响
+         * @return  错误码
+        */
+        int cleanup();
+
+    private:
+        struct poolstate;
+        std::shared_ptr<poolstate> state_;
+    };
+
+    // 延时统计
+    typedef struct glatencystats
+    {
+        uint64_t count; // 样本数
+        int64_t minus;  // 最小值(微秒)
+        int64_t maxus;  // 最大值(微秒)
+        int64_t meanus; // 平均值(微秒)
+        int64_t p50us;  // 50%分位(微秒)
+        int64_t p90us;  // 90%分位(微秒)
+        int64_t p99us;  // 99%分位(微秒)
+    } glatencystats;
+
+    // 延时直方图
+    // 每个2的幂区间分4个桶, 分位值误差不超过25%, 记录不加锁
+    class glatencyhistogram
+    {
+    public:
+        glatencyhistogram();
+        glatencyhistogram(const glatencyhistogram&) = delete;
+        glatencyhistogram& operator=(const glatencyhistogram&) = delete;
+
+        /*
+         * @brief           记录一个样本
+         * @param us[in]    延时(微秒)
+        */
+        void record(int64_t us);
+
+        /*
+         * @brief               获取统计, 分位值取所在桶的上界
+         * @return              错误码
+         * @param stats[out]    接收统计
+        */
+        int get_stats(glatencystats& stats);
+
+        /*
+         * @brief               获取各桶的样本数
+         * @return              错误码
+         * @param buckets[out]  接收(桶上界(微秒), 样本数), 只包含非空桶
+        */
+        int get_buckets(std::vector<std::pair<int64_t, uint64_t>>& buckets);
+
+        /*
+         * @brief   清空
+         * @return  错误码
+        */
+        int reset();
+
+    private:
+        static const int BUCKETS = 136;
+        static int bucket_index(int64_t us);
+        static int64_t bucket_upper(int index);
+
+        std::atomic<uint64_t> buckets_[BUCKETS];
+        std::atomic<uint64_t> count_;
+        std::atomic<int64_t> sum_;
+        std::atomic<int64_t> min_;
+        std::atomic<int64_t> max_;
+    };
+
+    // 取消标记, 可以在多个对象之间共享, 任意线程调用
+    class gcanceltoken
+    {
+    public:
+        // 取消, 使用这个标记的阻塞I/O尽快返回AVERROR_EXIT
+        void cancel();
+        // 恢复
+        void reset();
+        // 是否已取消
+        bool cancelled() const;
+
+    private:
+        std::atomic<bool> cancelled_{ false };
+    };
+
+    // AVFormatContext::interrupt_callback的状态
+    // 取消标记被取消, 或者当前阻塞I/O超过截止时间时中断
+    class giointerrupt
+    {
+    public:
+        giointerrupt();
+        giointerrupt(const giointerrupt&) = delete;
+        giointerrupt& operator=(const giointerrupt&) = delete;
+
+        /*
+         * @brief           设置取消标记, 不能与I/O和cancel同时调用
+         * @param token[in] 取消标记, 为空时使用自己的标记
+        */
+        void set_token(const std::shared_ptr<gcanceltoken>& token);
+
+        // 取消
+        void cancel();
+
+        // 恢复自己的标记, 共享的标记由调用者恢复
+        void reset();
+
+        // 中断当前和之后的阻塞I/O直到resume, 只影响本对象, 用于停止内部线程
+        void abort();
+        void resume();
+
+        /*
+         * @brief               设置每次阻塞I/O的超时
+         * @param timeoutus[in] 超时(微秒), 0为不限制
+        */
+        void set_timeout(int64_t timeoutus);
+
+        // 开始和结束一次阻塞I/O, 开始时按超时设置截止时间
+        void begin();
+        void end();
+
+        // 获取回调
+        AVIOInterruptCB get_callback();
+
+    private:
+        static int interrupt(void* opaque);
+
+        std::shared_ptr<gcanceltoken> owntoken_;
+        std::shared_ptr<gcanceltoken> token_;
+        std::atomic<int64_t> timeout_{ 0 };
+        std::atomic<int64_t> deadline_{ 0 };
+        std::atomic<bool> aborted_{ false };
+    };
 }//gff
 
 #endif//__GUTIL_H__
@@ -1,5 +1,6 @@
 ﻿#include <iostream>
 #include <fstream>
+#include <chrono>
 
 #include "../src/gutil.h"
 #include "../src/gdemux.h"
@@ -8,6 +9,14 @@
 #include "../src/gmux.h"
 #include "../src/gsws.h"
 #include "../src/gswr.h"
+#include "../src/gpipeline.h"
+#include "../src/gseeker.h"
+#include "../src/gpardec.h"
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
 
 #define     G_ERROR_SUCCEED          0      //succeed
 #define     G_ERROR_INVALIDPARAM    -1      //invalid param
@@ -162,6 +171,877 @@ int test_demux(const char* in)
 	return 0;
 }
 
+int test_demux_mmap(const char* in)
+{
+	auto begin = std::chrono::steady_clock::now();
+	gff::gdemux demux;
+	auto ret = demux.open_mmap(in);
+	CHECKFFRET(ret);
+	auto opened = std::chrono::steady_clock::now();
+	std::cout << "open : " << std::chrono::duration_cast<std::chrono::microseconds>(opened - begin).count() << " us" << std::endl;
+
+	const AVCodecParameters* par = nullptr;
+	AVRational timebase;
+	auto packet = gff::GetPacket();
+	int64_t packets = 0;
+	int seeks = 0;
+	while (demux.readpacket(packet) == 0)
+	{
+		++packets;
+		demux.get_stream_par(packet->stream_index, par, timebase);
+		if (av_rescale_q(packet->pts, timebase, { 1,1 }) >= 10 && seeks++ < 10)
+		{
+			demux.seek_frame(packet->stream_index, av_rescale_q(2, { 1,1 }, timebase));
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "read " << packets << " packets, " << seeks << " seeks : " <<
+		std::chrono::duration_cast<std::chrono::microseconds>(end - opened).count() << " us" << std::endl;
+
+	ret = demux.cleanup();
+	CHECKFFRET(ret);
+
+	return 0;
+}
+
+// 内存输入回调, 数据先拷贝到avio缓冲区
+struct gmemsource
+{
+	const std::vector<uint8_t>* data;
+	size_t pos;
+};
+int memreadpacket(void* opaque, uint8_t* buf, int buf_size)
+{
+	auto src = static_cast<gmemsource*>(opaque);
+	auto left = src->data->size() - src->pos;
+	if (left == 0)
+	{
+		return AVERROR_EOF;
+	}
+	auto len = static_cast<size_t>(buf_size) < left ? static_cast<size_t>(buf_size) : left;
+	memcpy(buf, src->data->data() + src->pos, len);
+	src->pos += len;
+	return static_cast<int>(len);
+}
+
+int test_demux_memory(const char* in, int count)
+{
+	std::ifstream f(in, std::ios::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	if (data.empty())
+	{
+		CHECKFFRET(AVERROR(ENOENT));
+	}
+
+	// 回调拷贝和直接从内存读取
+	for (int m = 0; m < 2; ++m)
+	{
+		int64_t packets = 0;
+		auto begin = std::chrono::steady_clock::now();
+		for (int i = 0; i < count; ++i)
+		{
+			gff::gdemux demux;
+			gmemsource src = { &data, 0 };
+			auto ret = m == 0 ? demux.open(in, nullptr, {}, memreadpacket, &src) : demux.open_memory(data.data(), data.size(), in);
+			CHECKFFRET(ret);
+			auto packet = gff::GetPacket();
+			while (demux.readpacket(packet) == 0)
+			{
+				++packets;
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		std::cout << (m == 0 ? "callback" : "memory") << " : " << packets / (count > 0 ? count : 1) << " packets, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / (count > 0 ? count : 1) << " us/open+read" << std::endl;
+	}
+
+	return 0;
+}
+
+// 文件输入, seekable为假时模拟只能顺序读取的存储
+class gfileio : public gff::gdemuxio
+{
+public:
+	gfileio(const char* in, bool seekable)
+		: file_(in, std::ios::binary), seekable_(seekable)
+	{
+		file_.seekg(0, std::ios::end);
+		size_ = file_.tellg();
+		file_.seekg(0, std::ios::beg);
+	}
+
+	int read(uint8_t* buf, int size) override
+	{
+		file_.read(reinterpret_cast<char*>(buf), size);
+		auto len = static_cast<int>(file_.gcount());
+		file_.clear();
+		return len > 0 ? len : AVERROR_EOF;
+	}
+	int64_t seek(int64_t pos) override
+	{
+		file_.seekg(pos, std::ios::beg);
+		return file_ ? pos : AVERROR(EIO);
+	}
+	int64_t size() override
+	{
+		return size_;
+	}
+	bool seekable() override
+	{
+		return seekable_;
+	}
+
+private:
+	std::ifstream file_;
+	int64_t size_ = 0;
+	bool seekable_ = true;
+};
+
+int test_demux_seek(const char* in, int count)
+{
+	for (auto seekable : { true, false })
+	{
+		gfileio io(in, seekable);
+		gff::gdemux demux;
+		auto begin = std::chrono::steady_clock::now();
+		auto ret = demux.open_io(&io, in);
+		CHECKFFRET(ret);
+		auto opened = std::chrono::steady_clock::now();
+
+		int64_t duration = 0;
+		ret = demux.get_duration(duration, { 1, 1000 });
+		CHECKFFRET(ret);
+		std::vector<unsigned int> videovec, audiovec;
+		ret = demux.get_steam_index(videovec, audiovec);
+		CHECKFFRET(ret);
+		const AVCodecParameters* par = nullptr;
+		AVRational timebase;
+		ret = demux.get_stream_par(videovec.at(0), par, timebase);
+		CHECKFFRET(ret);
+
+		// 固定种子的随机位置, 两种方式跳转到相同位置
+		auto packet = gff::GetPacket();
+		int succeed = 0;
+		srand(1);
+		auto seekbegin = std::chrono::steady_clock::now();
+		for (int i = 0; i < count; ++i)
+		{
+			auto ms = duration > 0 ? rand() % duration : 0;
+			if (demux.seek_frame(videovec.at(0), av_rescale_q(ms, { 1, 1000 }, timebase)) >= 0 &&
+				demux.readpacket(packet) == 0)
+			{
+				++succeed;
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		std::cout << (seekable ? "with" : "without") << " seek callback : open " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(opened - begin).count() << " us, " <<
+			succeed << "/" << count << " seeks, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - seekbegin).count() / (count > 0 ? count : 1) << " us/seek" << std::endl;
+
+		demux.cleanup();
+	}
+
+	return 0;
+}
+
+int test_demux_readahead(const char* in)
+{
+	gff::gdemux demux;
+	auto ret = demux.open(in);
+	CHECKFFRET(ret);
+	ret = demux.start_readahead(4 * 1024 * 1024, 2 * AV_TIME_BASE);
+	CHECKFFRET(ret);
+
+	auto packet = gff::GetPacket();
+	gff::greadaheadstats stats = { 0 };
+	int64_t packets = 0;
+	while (demux.readpacket(packet) == 0)
+	{
+		if (++packets % 100 == 0)
+		{
+			demux.get_readahead_stats(stats);
+			std::cout << "buffered " << stats.packets << " packets " << stats.bytes << " bytes " <<
+				stats.durationus << " us fullness " << stats.fullness << std::endl;
+		}
+	}
+	demux.get_readahead_stats(stats);
+	std::cout << "reads " << stats.reads << " underruns " << stats.underruns << std::endl;
+
+	ret = demux.cleanup();
+	CHECKFFRET(ret);
+
+	return 0;
+}
+
+int test_demux_open(const char* in, int count)
+{
+	struct
+	{
+		const char* name;
+		gff::OPENPROFILE profile;
+		const char* cache;
+	} cases[] = {
+		{ "default", gff::OPEN_DEFAULT, nullptr },
+		{ "fast", gff::OPEN_FAST, nullptr },
+		{ "fast+cache", gff::OPEN_FAST, "." },
+	};
+
+	for (const auto& c : cases)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		for (int i = 0; i < count; ++i)
+		{
+			gff::gdemux demux;
+			auto ret = demux.set_open_profile(c.profile);
+			CHECKFFRET(ret);
+			ret = demux.set_info_cache(c.cache);
+			CHECKFFRET(ret);
+			ret = demux.open(in);
+			CHECKFFRET(ret);
+			demux.cleanup();
+		}
+		auto end = std::chrono::steady_clock::now();
+		std::cout << c.name << " : " << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / (count > 0 ? count : 1) <<
+			" us/open" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_demux_select(const char* in)
+{
+	// 多音轨文件上比较读取所有流和只读取一个流
+	for (int c = 0; c < 3; ++c)
+	{
+		gff::gdemux demux;
+		auto ret = demux.open(in);
+		CHECKFFRET(ret);
+		std::vector<unsigned int> videovec, audiovec;
+		ret = demux.get_steam_index(videovec, audiovec);
+		CHECKFFRET(ret);
+
+		const char* name = "all";
+		if (c == 1 && !videovec.empty())
+		{
+			name = "video";
+			ret = demux.select_streams({ videovec[0] });
+		}
+		else if (c == 2 && !audiovec.empty())
+		{
+			name = "audio";
+			ret = demux.select_streams({ audiovec[0] });
+		}
+		CHECKFFRET(ret);
+
+		auto packet = gff::GetPacket();
+		uint64_t packets = 0, bytes = 0;
+		auto begin = std::chrono::steady_clock::now();
+		while (demux.readpacket(packet) == 0)
+		{
+			++packets;
+			bytes += packet->size;
+		}
+		auto end = std::chrono::steady_clock::now();
+		std::cout << name << " : " << audiovec.size() << " audio tracks, " << packets << " packets, " << bytes << " bytes, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " us" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_demux_batch(const char* in, size_t batch)
+{
+	// 逐个读取解码和批量读取解码
+	for (int b = 0; b < 2; ++b)
+	{
+		gff::gdemux demux;
+		auto ret = demux.open(in);
+		CHECKFFRET(ret);
+		std::vector<unsigned int> videovec, audiovec;
+		ret = demux.get_steam_index(videovec, audiovec);
+		CHECKFFRET(ret);
+		ret = demux.select_streams({ videovec.at(0) });
+		CHECKFFRET(ret);
+		const AVCodecParameters* par = nullptr;
+		AVRational timebase;
+		ret = demux.get_stream_par(videovec.at(0), par, timebase);
+		CHECKFFRET(ret);
+		gff::gdec dec;
+		ret = dec.copy_param(par);
+		CHECKFFRET(ret);
+
+		uint64_t packets = 0, frames = 0;
+		auto begin = std::chrono::steady_clock::now();
+		if (b == 0)
+		{
+			auto packet = gff::GetPacket();
+			auto frame = gff::GetFrame();
+			while (demux.readpacket(packet) == 0)
+			{
+				++packets;
+				ret = dec.decode(packet, frame);
+				while (ret >= 0)
+				{
+					++frames;
+					ret = dec.decode(nullptr, frame);
+				}
+			}
+		}
+		else
+		{
+			std::vector<std::shared_ptr<AVPacket>> packetvec;
+			for (size_t i = 0; i < batch; ++i)
+			{
+				packetvec.push_back(gff::GetPacket());
+			}
+			std::vector<std::shared_ptr<AVFrame>> framevec;
+			size_t count = 0;
+			while (demux.readpackets(packetvec, count) == 0)
+			{
+				packets += count;
+				framevec.clear();
+				ret = dec.decode(packetvec, count, framevec);
+				CHECKFFRET(ret);
+				frames += framevec.size();
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		std::cout << (b == 0 ? "single" : "batch") << " : " << packets << " packets, " << frames << " frames, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " us" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_demux_live(int count)
+{
+	// gdigrab的pts是抓屏时的系统时间(微秒), 可以直接算出从采集到readpacket返回的延时
+	for (int live = 0; live < 2; ++live)
+	{
+		gff::gdemux demux;
+		auto ret = demux.set_open_profile(live ? gff::OPEN_LIVE : gff::OPEN_DEFAULT);
+		CHECKFFRET(ret);
+		auto begin = std::chrono::steady_clock::now();
+		ret = demux.open("desktop", "gdigrab", { {"framerate", "30"} });
+		CHECKFFRET(ret);
+		auto opened = std::chrono::steady_clock::now();
+		const AVCodecParameters* par = nullptr;
+		AVRational timebase;
+		ret = demux.get_stream_par(0, par, timebase);
+		CHECKFFRET(ret);
+
+		auto packet = gff::GetPacket();
+		gff::glatencyhistogram delay;
+		for (int i = 0; i < count && demux.readpacket(packet) == 0; ++i)
+		{
+			delay.record(av_gettime() - av_rescale_q(packet->pts, timebase, { 1, AV_TIME_BASE }));
+		}
+		gff::glatencystats stats, arrival;
+		delay.get_stats(stats);
+		ret = demux.get_arrival_stats(arrival);
+		CHECKFFRET(ret);
+		std::cout << (live ? "live" : "default") << " : open " << std::chrono::duration_cast<std::chrono::microseconds>(opened - begin).count() <<
+			" us, capture->readpacket mean " << stats.meanus << " us p99 " << stats.p99us << " us, in gdemux mean " << arrival.meanus << " us" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_demux_cancel(const char* in)
+{
+	// in为没有数据的实时输入, 例如"tcp://127.0.0.1:12345?listen=1", 打开会一直阻塞
+	for (int timeout = 0; timeout < 2; ++timeout)
+	{
+		gff::gdemux demux;
+		auto token = std::make_shared<gff::gcanceltoken>();
+		auto ret = demux.set_cancel_token(token);
+		CHECKFFRET(ret);
+		ret = demux.set_io_timeout(timeout ? AV_TIME_BASE / 2 : 0);
+		CHECKFFRET(ret);
+
+		auto begin = std::chrono::steady_clock::now();
+		std::thread canceller;
+		if (!timeout)
+		{
+			canceller = std::thread([&token]() {
+				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+				token->cancel();
+				});
+		}
+		ret = demux.open(in);
+		auto end = std::chrono::steady_clock::now();
+		if (canceller.joinable())
+		{
+			canceller.join();
+		}
+		std::cout << (timeout ? "timeout 500ms" : "cancel after 200ms") << " : " << ret << " " << av_err2str(ret) << ", returned after " <<
+			std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << " ms" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_demux_normalize(const char* in)
+{
+	// in可以是跨33位回绕或拼接过的ts, 规整后每个流的dts递增且从0附近开始
+	gff::gdemux demux;
+	auto ret = demux.open(in);
+	CHECKFFRET(ret);
+	ret = demux.set_normalize(true, { 1, 1000 });
+	CHECKFFRET(ret);
+
+	std::map<int, int64_t> first, last;
+	int64_t packets = 0, errors = 0;
+	auto packet = gff::GetPacket();
+	while (demux.readpacket(packet) == 0)
+	{
+		++packets;
+		if (first.find(packet->stream_index) == first.end())
+		{
+			first[packet->stream_index] = packet->dts;
+		}
+		else if (packet->dts <= last[packet->stream_index] ||
+			(packet->pts != AV_NOPTS_VALUE && packet->pts < packet->dts))
+		{
+			++errors;
+		}
+		last[packet->stream_index] = packet->dts;
+	}
+	for (const auto& f : first)
+	{
+		std::cout << "stream " << f.first << " : dts " << f.second << " ms -> " << last[f.first] << " ms" << std::endl;
+	}
+	std::cout << packets << " packets, " << errors << " non-monotonic" << std::endl;
+
+	return 0;
+}
+
+int test_demux_index(const char* in, int count)
+{
+	// 第一次扫描并写索引文件, 第二次直接读取
+	for (int i = 0; i < 2; ++i)
+	{
+		gff::gdemux demux;
+		auto ret = demux.open(in);
+		CHECKFFRET(ret);
+		std::vector<unsigned int> videovec, audiovec;
+		ret = demux.get_steam_index(videovec, audiovec);
+		CHECKFFRET(ret);
+		auto begin = std::chrono::steady_clock::now();
+		ret = demux.build_index(videovec.at(0));
+		CHECKFFRET(ret);
+		auto end = std::chrono::steady_clock::now();
+		std::vector<gff::gindexentry> entries;
+		ret = demux.get_index(videovec.at(0), entries);
+		CHECKFFRET(ret);
+		std::cout << "build index : " << entries.size() << " entries, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " us" << std::endl;
+		if (i == 0 || entries.empty())
+		{
+			continue;
+		}
+
+		// 跳转后读到的第一个包应该是索引给出的关键帧
+		auto packet = gff::GetPacket();
+		int hits = 0, decodes = 0;
+		begin = std::chrono::steady_clock::now();
+		for (int j = 0; j < count; ++j)
+		{
+			const auto& target = entries[rand() % entries.size()];
+			gff::gindexseek result;
+			ret = demux.seek_index(videovec.at(0), target.pts != AV_NOPTS_VALUE ? target.pts : target.dts, result);
+			CHECKFFRET(ret);
+			while ((ret = demux.readpacket(packet)) == 0 && packet->stream_index != static_cast<int>(videovec.at(0)));
+			CHECKFFRET(ret);
+			if ((packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts) == result.keypts)
+			{
+				++hits;
+			}
+			decodes += result.decodes;
+		}
+		end = std::chrono::steady_clock::now();
+		std::cout << "seek index : " << hits << "/" << count << " exact, " << decodes / (count > 0 ? count : 1) << " decodes/seek, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / (count > 0 ? count : 1) << " us/seek" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_seeker(const char* in, bool useindex)
+{
+	gff::gdemux demux;
+	auto ret = demux.open(in);
+	CHECKFFRET(ret);
+	std::vector<unsigned int> videovec, audiovec;
+	ret = demux.get_steam_index(videovec, audiovec);
+	CHECKFFRET(ret);
+	const AVCodecParameters* par = nullptr;
+	AVRational timebase;
+	ret = demux.get_stream_par(videovec.at(0), par, timebase);
+	CHECKFFRET(ret);
+	if (useindex)
+	{
+		ret = demux.build_index(videovec.at(0));
+		CHECKFFRET(ret);
+	}
+	int64_t duration = 0;
+	ret = demux.get_duration(duration, { 1, AV_TIME_BASE });
+	CHECKFFRET(ret);
+
+	gff::gdec dec;
+	ret = dec.copy_param(par);
+	CHECKFFRET(ret);
+
+	// 顺序拖动(每次前进40ms)和随机跳转
+	auto frame = gff::GetFrame();
+	for (int random = 0; random < 2; ++random)
+	{
+		gff::gseeker seeker;
+		ret = seeker.open(&demux, videovec.at(0), &dec);
+		CHECKFFRET(ret);
+		auto begin = std::chrono::steady_clock::now();
+		int count = 0;
+		for (int64_t t = 0; t < duration && count < 500; t += AV_TIME_BASE / 25, ++count)
+		{
+			auto target = random ? rand() % (duration > 0 ? duration : 1) : t;
+			ret = seeker.seek(target, frame);
+			CHECKFFRET(ret);
+		}
+		auto end = std::chrono::steady_clock::now();
+		gff::gseekerstats stats;
+		ret = seeker.get_stats(stats);
+		CHECKFFRET(ret);
+		std::cout << (random ? "random" : "scrub") << " : " << stats.requests << " requests, " << stats.seeks << " seeks, " <<
+			stats.forwards << " forwards, " << stats.packets << " packets, " << stats.skipped << " skipped, " << stats.frames << " frames, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / (count > 0 ? count : 1) << " us/request" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_pardec(const char* in, size_t workers)
+{
+	// 1个线程和workers个线程分别解码整个文件, 比较速度
+	size_t settings[] = { 1, workers };
+	for (auto threads : settings)
+	{
+		gff::gdemux demux;
+		auto ret = demux.open(in);
+		CHECKFFRET(ret);
+		std::vector<unsigned int> videovec, audiovec;
+		ret = demux.get_steam_index(videovec, audiovec);
+		CHECKFFRET(ret);
+		ret = demux.build_index(videovec.at(0));
+		CHECKFFRET(ret);
+		ret = demux.select_streams({ videovec.at(0) });
+		CHECKFFRET(ret);
+
+		gff::gpardec pardec;
+		auto begin = std::chrono::steady_clock::now();
+		ret = pardec.open(&demux, videovec.at(0), threads);
+		CHECKFFRET(ret);
+		auto frame = gff::GetFrame();
+		int64_t lastpts = AV_NOPTS_VALUE, disorders = 0;
+		while ((ret = pardec.decode(frame)) == 0)
+		{
+			if (lastpts != AV_NOPTS_VALUE && frame->pts != AV_NOPTS_VALUE && frame->pts <= lastpts)
+			{
+				++disorders;
+			}
+			lastpts = frame->pts;
+		}
+		auto end = std::chrono::steady_clock::now();
+		gff::gpardecstats stats;
+		ret = pardec.get_stats(stats);
+		CHECKFFRET(ret);
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+		std::cout << threads << " threads : " << stats.frames << " frames, " << (us > 0 ? stats.frames * 1000000.0 / us : 0) << " fps, " <<
+			stats.gops << " gops, " << stats.redecodes << " redecoded packets, " << stats.errors << " errors, " << disorders << " out of order" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_dec_preview(const char* in)
+{
+	// 同一个解码器运行时切换预览级别, 每次从头解码整个文件
+	const struct
+	{
+		const char* name;
+		gff::DECPREVIEW level;
+		bool fast;
+	} settings[] = {
+		{ "full", gff::DECPREVIEW_NONE, false },
+		{ "nonref", gff::DECPREVIEW_NONREF, false },
+		{ "nonref fast", gff::DECPREVIEW_NONREF, true },
+		{ "intra fast", gff::DECPREVIEW_INTRA, true },
+		{ "key fast", gff::DECPREVIEW_KEY, true },
+	};
+	gff::gdemux demux;
+	auto ret = demux.open(in);
+	CHECKFFRET(ret);
+	std::vector<unsigned int> videovec, audiovec;
+	ret = demux.get_steam_index(videovec, audiovec);
+	CHECKFFRET(ret);
+	ret = demux.select_streams({ videovec.at(0) });
+	CHECKFFRET(ret);
+	const AVCodecParameters* par = nullptr;
+	AVRational timebase;
+	ret = demux.get_stream_par(videovec.at(0), par, timebase);
+	CHECKFFRET(ret);
+	gff::gdec dec;
+	ret = dec.copy_param(par);
+	CHECKFFRET(ret);
+
+	auto packet = gff::GetPacket();
+	auto frame = gff::GetFrame();
+	for (const auto& setting : settings)
+	{
+		ret = demux.seek_frame(videovec.at(0), 0, false);
+		CHECKFFRET(ret);
+		ret = dec.flush();
+		CHECKFFRET(ret);
+		ret = dec.set_preview(setting.level, setting.fast);
+		CHECKFFRET(ret);
+
+		uint64_t packets = 0, frames = 0;
+		auto begin = std::chrono::steady_clock::now();
+		while (demux.readpacket(packet) == 0)
+		{
+			++packets;
+			ret = dec.decode(packet, frame);
+			while (ret >= 0)
+			{
+				++frames;
+				ret = dec.decode(nullptr, frame);
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		std::cout << setting.name << " : " << packets << " packets, " << frames << " frames, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " us" << std::endl;
+	}
+
+	return 0;
+}
+
+int test_dec_all(const char* in)
+{
+	// 逐帧decode和decode_all分别解码并排空
+	for (int all = 0; all < 2; ++all)
+	{
+		gff::gdemux demux;
+		auto ret = demux.open(in);
+		CHECKFFRET(ret);
+		std::vector<unsigned int> videovec, audiovec;
+		ret = demux.get_steam_index(videovec, audiovec);
+		CHECKFFRET(ret);
+		ret = demux.select_streams({ videovec.at(0) });
+		CHECKFFRET(ret);
+		const AVCodecParameters* par = nullptr;
+		AVRational timebase;
+		ret = demux.get_stream_par(videovec.at(0), par, timebase);
+		CHECKFFRET(ret);
+		gff::gdec dec;
+		ret = dec.copy_param(par);
+		CHECKFFRET(ret);
+
+		uint64_t frames = 0, calls = 0;
+		auto packet = gff::GetPacket();
+		auto begin = std::chrono::steady_clock::now();
+		if (!all)
+		{
+			while (demux.readpacket(packet) == 0)
+			{
+				auto frame = gff::GetFrame();
+				ret = dec.decode(packet, frame);
+				++calls;
+				while (ret >= 0)
+				{
+					++frames;
+					frame = gff::GetFrame();
+					ret = dec.decode(nullptr, frame);
+					++calls;
+				}
+			}
+			av_packet_unref(packet.get());
+			auto frame = gff::GetFrame();
+			ret = dec.decode(packet, frame);
+			++calls;
+			while (ret >= 0)
+			{
+				++frames;
+				frame = gff::GetFrame();
+				ret = dec.decode(nullptr, frame);
+				++calls;
+			}
+		}
+		else
+		{
+			auto onframe = [&frames](const std::shared_ptr<AVFrame>& frame) {
+				++frames;
+				return 0;
+			};
+			while (demux.readpacket(packet) == 0)
+			{
+				ret = dec.decode_all(packet, onframe);
+				++calls;
+				CHECKFFRET(ret);
+			}
+			// 排空
+			ret = dec.decode_all(nullptr, onframe);
+			++calls;
+			if (ret != AVERROR_EOF)
+			{
+				CHECKFFRET(ret);
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		std::cout << (all ? "decode_all" : "decode") << " : " << frames << " frames, " << calls << " calls, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " us" << std::endl;
+	}
+
+	return 0;
+}
+
+// 统计分配次数的分配器
+class gcountallocator : public gff::gframeallocator
+{
+public:
+	AVBufferRef* alloc(int size) override
+	{
+		++count;
+		return av_buffer_alloc(size);
+	}
+	std::atomic<uint64_t> count{ 0 };
+};
+
+int test_dec_allocator(const char* in)
+{
+	// 默认分配, 缓冲池分配, 自定义分配分别解码
+	for (int a = 0; a < 3; ++a)
+	{
+		gff::gdemux demux;
+		auto ret = demux.open(in);
+		CHECKFFRET(ret);
+		std::vector<unsigned int> videovec, audiovec;
+		ret = demux.get_steam_index(videovec, audiovec);
+		CHECKFFRET(ret);
+		ret = demux.select_streams({ videovec.at(0) });
+		CHECKFFRET(ret);
+		const AVCodecParameters* par = nullptr;
+		AVRational timebase;
+		ret = demux.get_stream_par(videovec.at(0), par, timebase);
+		CHECKFFRET(ret);
+
+		auto pool = std::make_shared<gff::gpoolallocator>();
+		auto counter = std::make_shared<gcountallocator>();
+		gff::gdec dec;
+		if (a > 0)
+		{
+			ret = dec.set_allocator(a == 1 ? std::static_pointer_cast<gff::gframeallocator>(pool) : counter);
+			CHECKFFRET(ret);
+		}
+		ret = dec.copy_param(par);
+		CHECKFFRET(ret);
+
+		uint64_t frames = 0;
+		auto packet = gff::GetPacket();
+		auto frame = gff::GetFrame();
+		auto begin = std::chrono::steady_clock::now();
+		while (demux.readpacket(packet) == 0)
+		{
+			ret = dec.decode(packet, frame);
+			while (ret >= 0)
+			{
+				++frames;
+				ret = dec.decode(nullptr, frame);
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		uint64_t hits = 0, misses = 0;
+		pool->get_stats(hits, misses);
+		std::cout << (a == 0 ? "default" : (a == 1 ? "pool" : "custom")) << " : " << frames << " frames, " <<
+			std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " us, pool hits " << hits << " misses " << misses <<
+			", custom allocs " << counter->count << std::endl;
+	}
+
+	return 0;
+}
+
+int test_dec_threads(const char* in)
+{
+	// 同一个输入按不同线程设置解码, 延时为送入包到输出第一帧之间的包数和耗时
+	const struct
+	{
+		const char* name;
+		gff::DECTHREAD type;
+		int count;
+	} settings[] = {
+		{ "single", gff::DECTHREAD_AUTO, 1 },
+		{ "auto", gff::DECTHREAD_AUTO, 0 },
+		{ "frame x4", gff::DECTHREAD_FRAME, 4 },
+		{ "frame auto", gff::DECTHREAD_FRAME, 0 },
+		{ "slice x4", gff::DECTHREAD_SLICE, 4 },
+		{ "slice auto", gff::DECTHREAD_SLICE, 0 },
+	};
+	for (const auto& setting : settings)
+	{
+		gff::gdemux demux;
+		auto ret = demux.open(in);
+		CHECKFFRET(ret);
+		std::vector<unsigned int> videovec, audiovec;
+		ret = demux.get_steam_index(videovec, audiovec);
+		CHECKFFRET(ret);
+		ret = demux.select_streams({ videovec.at(0) });
+		CHECKFFRET(ret);
+		const AVCodecParameters* par = nullptr;
+		AVRational timebase;
+		ret = demux.get_stream_par(videovec.at(0), par, timebase);
+		CHECKFFRET(ret);
+		gff::gdec dec;
+		ret = dec.set_threads(setting.type, setting.count);
+		CHECKFFRET(ret);
+		ret = dec.copy_param(par, AV_HWDEVICE_TYPE_NONE, { {"refcounted_frames", "1"} });
+		CHECKFFRET(ret);
+
+		uint64_t packets = 0, frames = 0, delaypackets = 0;
+		int64_t delayus = 0;
+		auto packet = gff::GetPacket();
+		auto frame = gff::GetFrame();
+		auto begin = std::chrono::steady_clock::now();
+		while (demux.readpacket(packet) == 0)
+		{
+			++packets;
+			ret = dec.decode(packet, frame);
+			while (ret >= 0)
+			{
+				if (frames++ == 0)
+				{
+					delaypackets = packets;
+					delayus = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+				}
+				ret = dec.decode(nullptr, frame);
+			}
+		}
+		// 排空
+		av_packet_unref(packet.get());
+		ret = dec.decode(packet, frame);
+		while (ret >= 0)
+		{
+			++frames;
+			ret = dec.decode(nullptr, frame);
+		}
+		auto end = std::chrono::steady_clock::now();
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+		std::cout << setting.name << " : " << frames << " frames, " << (us > 0 ? frames * 1000000.0 / us : 0) << " fps, first frame after " <<
+			delaypackets << " packets " << delayus << " us" << std::endl;
+	}
+
+	return 0;
+}
+
 int test_dec(const char* in)
 {
 	gff::gdemux demux;
@@ -313,12 +1193,13 @@ int test_enc_video(const char* in)
 	CHECKFFRET(ret);
 
 	std::ofstream out("out.h264", std::ios::binary | std::ios::trunc);
+	gff::gframepool framepool;
 
 	while (!yuv.eof())
 	{
 		auto packet = gff::GetPacket();
-		auto frame = gff::GetFrame();
-		ret = gff::GetFrameBuf(frame, width, height, AV_PIX_FMT_YUV420P, 1);
+		decltype(gff::GetFrame()) frame = nullptr;
+		ret = framepool.get_frame(frame, width, height, AV_PIX_FMT_YUV420P, 1);
 		CHECKFFRET(ret);
 		ret = gff::frame_make_writable(frame);
 		CHECKFFRET(ret);
@@ -348,6 +1229,10 @@ int test_enc_video(const char* in)
 	}
 	enc.cleanup();
 
+	uint64_t hits = 0, misses = 0;
+	framepool.get_stats(hits, misses);
+	std::cout << "frame pool hits : " << hits << " misses : " << misses << std::endl;
+
 	return 0;
 }
 
@@ -432,12 +1317,13 @@ int test_mux(const char* out)
 	ret = mux.get_timebase(vindex, ovtimebase);
 	CHECKFFRET(ret);
 
+	gff::gframepool framepool;
 	int i = 0;
 	while (!nv12.eof())
 	{
 		auto packet = gff::GetPacket();
-		auto frame = gff::GetFrame();
-		ret = gff::GetFrameBuf(frame, width, height, AV_PIX_FMT_NV12, 1);
+		decltype(gff::GetFrame()) frame = nullptr;
+		ret = framepool.get_frame(frame, width, height, AV_PIX_FMT_NV12, 1);
 		CHECKFFRET(ret);
 		ret = av_frame_make_writable(frame.get());
 		CHECKFFRET(ret);
@@ -583,6 +1469,139 @@ int test_swr(const char* in)
 	return 0;
 }
 
+// 加解锁一次的耗时(纳秒)
+template<typename MUTEX>
+static double bench_lock(int count)
+{
+	MUTEX mutex;
+	auto begin = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; ++i)
+	{
+		std::lock_guard<MUTEX> lck(mutex);
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - begin).count() / count;
+}
+
+int test_lock_overhead(int count)
+{
+	std::cout << "lock policy " << GFF_LOCK_POLICY << std::endl;
+	std::cout << "recursive_mutex " << bench_lock<std::recursive_mutex>(count) << " ns/call" << std::endl;
+	std::cout << "mutex " << bench_lock<std::mutex>(count) << " ns/call" << std::endl;
+	std::cout << "gnolock " << bench_lock<gff::gnolock>(count) << " ns/call" << std::endl;
+
+	// 2x2转换, 耗时主要是调用本身
+	auto frame = gff::GetFrame();
+	auto frame2 = gff::GetFrame();
+	auto ret = gff::GetFrameBuf(frame, 2, 2, AV_PIX_FMT_YUV420P, 1);
+	CHECKFFRET(ret);
+	ret = gff::GetFrameBuf(frame2, 2, 2, AV_PIX_FMT_NV12, 1);
+	CHECKFFRET(ret);
+	gff::gsws sws;
+	ret = sws.create_sws(AV_PIX_FMT_YUV420P, 2, 2, AV_PIX_FMT_NV12, 2, 2);
+	CHECKFFRET(ret);
+
+	auto begin = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; ++i)
+	{
+		sws.scale(frame->data, frame->linesize, 0, frame->height, frame2->data, frame2->linesize);
+	}
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "gsws::scale " << std::chrono::duration<double, std::nano>(end - begin).count() / count << " ns/call" << std::endl;
+
+	sws.cleanup();
+
+	return 0;
+}
+
+int test_pipeline(const char* in, const char* out = "out.mp4", gff::gexecutor* executor = nullptr)
+{
+	gff::gdemux demux;
+	auto ret = demux.open(in);
+	CHECKFFRET(ret);
+	std::vector<unsigned int> videovec, audiovec;
+	ret = demux.get_steam_index(videovec, audiovec);
+	CHECKFFRET(ret);
+	const AVCodecParameters* par = nullptr;
+	AVRational timebase;
+	ret = demux.get_stream_par(videovec.at(0), par, timebase);
+	CHECKFFRET(ret);
+
+	gff::gdec dec;
+	ret = dec.copy_param(par);
+	CHECKFFRET(ret);
+
+	gff::genc enc;
+	ret = enc.set_video_param("libx264", 2000000, par->width, par->height, { 1,25 }, { 25,1 }, 50, 0, AV_PIX_FMT_YUV420P);
+	CHECKFFRET(ret);
+	const AVCodecContext* codectx = nullptr;
+	ret = enc.get_codectx(codectx);
+	CHECKFFRET(ret);
+
+	gff::gmux mux;
+	ret = mux.create_output(out);
+	CHECKFFRET(ret);
+	int oindex = -1;
+	ret = mux.create_stream(codectx, oindex);
+	CHECKFFRET(ret);
+	ret = mux.write_header();
+	CHECKFFRET(ret);
+
+	// 帧转换由流水线按需创建
+	gff::gpipeline pipeline;
+	ret = pipeline.set_stages(&demux, videovec.at(0), &dec, nullptr, &enc, &mux, oindex);
+	CHECKFFRET(ret);
+	ret = pipeline.start(executor);
+	CHECKFFRET(ret);
+	ret = pipeline.wait();
+	CHECKFFRET(ret);
+	ret = pipeline.stop();
+	CHECKFFRET(ret);
+
+	const char* names[gff::STAGE_NB] = { "demux", "decode", "scale", "encode", "mux" };
+	for (int i = 0; i < gff::STAGE_NB; ++i)
+	{
+		gff::gstagestats stats = { 0 };
+		ret = pipeline.get_stage_stats(static_cast<gff::PIPELINESTAGE>(i), stats);
+		CHECKFFRET(ret);
+		std::cout << names[i] << " : in " << stats.inputs << " out " << stats.outputs <<
+			" fps " << stats.fps << " load " << stats.load << std::endl;
+	}
+
+	mux.cleanup();
+	enc.cleanup();
+	dec.cleanup();
+	demux.cleanup();
+
+	return 0;
+}
+
+int test_pipeline_executor(const char* in, int count)
+{
+	// 多条流水线共享一个线程池
+	gff::gexecutor executor;
+	auto ret = executor.create();
+	CHECKFFRET(ret);
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < count; ++i)
+	{
+		threads.emplace_back([in, i, &executor]()
+			{
+				auto out = "out" + std::to_string(i) + ".mp4";
+				test_pipeline(in, out.c_str(), &executor);
+			});
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+
+	executor.cleanup();
+
+	return 0;
+}
+
 int test_record_audio()
 {
 	std::string in;
@@ -590,6 +1609,8 @@ int test_record_audio()
 	CHECKFFRET(ret);
 
 	gff::gdemux audio;
+	ret = audio.set_open_profile(gff::OPEN_LIVE);
+	CHECKFFRET(ret);
 	ret = audio.open(in.c_str(), "dshow");
 	CHECKFFRET(ret);
 	const AVCodecParameters* par = nullptr;
@@ -766,6 +1787,8 @@ int test_record_video()
 	CHECKFFRET(ret);
 
 	gff::gdemux video;
+	ret = video.set_open_profile(gff::OPEN_LIVE);
+	CHECKFFRET(ret);
 	ret = video.open(in.c_str(), "dshow", { {"framerate", "30"}});
 	CHECKFFRET(ret);
 	const AVCodecParameters* par = nullptr;
@@ -871,13 +1894,33 @@ int main(int argc, const char* argv[])
 	/// out.xxx等文件可以通过解码的例子生成
 
 	//test_demux("gx.mkv");
+	//test_demux_mmap("gx.mkv");
+	//test_demux_memory("gx.mkv", 10);
+	//test_demux_seek("gx.mkv", 100);
+	//test_demux_readahead("gx.mkv");
+	//test_demux_open("gx.mkv", 100);
+	//test_demux_select("multiaudio.mkv");
+	//test_demux_batch("gx.mkv", 32);
+	//test_demux_index("gx.mkv", 100);
+	//test_demux_live(300);
+	//test_demux_cancel("tcp://127.0.0.1:12345?listen=1");
+	//test_demux_normalize("gx.ts");
+	//test_seeker("gx.mkv", true);
+	//test_pardec("gx.mkv", 8);
 	//test_dec("gx.mkv");
 	//test_dec_h264("gx.h264");
+	//test_dec_threads("gx.mkv");
+	//test_dec_allocator("gx.mkv");
+	//test_dec_preview("gx.mkv");
+	//test_dec_all("gx.mkv");
 	//test_enc_video("out.yuv");
 	//test_enc_audio("out.pcm");
 	//test_sws("out.yuv");
 	//test_swr("out.pcm");
 	//test_mux("out.mp4");
+	//test_pipeline("gx.mkv");
+	//test_lock_overhead(10000000);
+	//test_pipeline_executor("gx.mkv", 4);
 
 	//test_record_audio();
 	test_record_video();